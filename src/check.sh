@@ -1,2 +1,2 @@
-gcc -o heartyfs_check heartyfs_check.c
+gcc -pthread -o heartyfs_check heartyfs_check.c op/heartyfs_functions.c op/heartyfs_disk.c op/heartyfs_checksum.c op/heartyfs_trace.c op/heartyfs_walk.c
 ./heartyfs_check
\ No newline at end of file
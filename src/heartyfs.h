@@ -14,6 +14,26 @@
 #define DIR_MAX_ENTRIES 14     // Maximum number of directory entries
 #define INODE_BLOCKS 119       // Maximum number of data blocks an inode can reference
 #define DATA_BLOCK_NAME_SIZE 508  // Space for data within a data block
+#define HOLE_BLOCK 0  // data_blocks[] value for an unallocated range that reads as zeros
+#define INFO_OFFSET (BLOCK_SIZE / 2) // heartyfs_info lives in the unused half of the bitmap block
+#define HEARTYFS_MAGIC 0x48465953 // "HFYS"
+#define HEARTYFS_FEATURE_DEDUP 0x1 // Share identical data blocks between inodes
+#define HEARTYFS_FEATURE_ENTRY_INFO 0x2 // Directories keep the type and size of their entries
+#define HEARTYFS_FEATURE_CHECKSUM 0x4 // Data blocks have a CRC32C in the checksum table
+#define HEARTYFS_FEATURE_FRAGMENTS 0x8 // Short file tails are packed into shared fragment blocks
+#define HEARTYFS_FEATURE_GENERATIONS 0x10 // Inodes and directories carry the generation of their last change
+#define ENTRY_INFO_DIRECTORY 0xFFFF // entry_info[] value of a subdirectory, files store their size
+#define FRAGMENT_UNIT 32       // Fragment blocks are handed out in 32 byte units
+#define FRAGMENT_UNITS (BLOCK_SIZE / FRAGMENT_UNIT) // 16 units, unit 0 holds the header
+#define FRAGMENT_TAIL_MAX (7 * FRAGMENT_UNIT) // Longest tail packed, every fragment block takes at least two
+#define FRAGMENT_MAGIC 0x48465447 // "HFTG"
+#define DATA_BLOCK_RESERVED 0x10000 // Flag in data_block.size of a block reserved by preallocation
+
+// A data_blocks[] value below -1 points at a tail in a fragment block: (block, unit)
+#define IS_FRAGMENT(entry) ((entry) < -1)
+#define FRAGMENT_ENTRY(block_id, unit) (-2 - (block_id) * FRAGMENT_UNITS - (unit))
+#define FRAGMENT_BLOCK(entry) ((-2 - (entry)) / FRAGMENT_UNITS)
+#define FRAGMENT_UNIT_OF(entry) ((-2 - (entry)) % FRAGMENT_UNITS)
 
 
     struct heartyfs_dir_entry {
@@ -26,6 +46,7 @@
         char name[FILENAME_MAXLEN];
         int size;
         struct heartyfs_dir_entry entries[DIR_MAX_ENTRIES];
+        unsigned short entry_info[DIR_MAX_ENTRIES]; // Type and size of each entry, fills the spare 28 bytes
     };
 
 
@@ -41,4 +62,35 @@
         char name[DATA_BLOCK_NAME_SIZE];    // 508 bytes
     };  // Overall: 512 bytes
 
+    struct heartyfs_info {
+        int magic;              // HEARTYFS_MAGIC once heartyfs_init has written the info
+        int num_blocks;         // Number of blocks in the image
+        int features;           // HEARTYFS_FEATURE_* flags
+        int ref_table;          // First block of the block reference table, -1 if none
+        int ref_table_blocks;   // Number of blocks used by the block reference table
+        int checksum_table;     // First block of the checksum table, valid with HEARTYFS_FEATURE_CHECKSUM
+        int checksum_table_blocks;
+        int fragment_block;     // Fragment block new tails go to, -1 if none, valid with HEARTYFS_FEATURE_FRAGMENTS
+        unsigned int generation;    // Generation of the latest change, valid with HEARTYFS_FEATURE_GENERATIONS
+        int generation_table;       // First block of the generation table
+        int generation_table_blocks;
+    };
+
+    struct heartyfs_fragment_block {
+        int magic;                              // FRAGMENT_MAGIC
+        unsigned short used;                    // Bit per unit in use, bit 0 is this header
+        unsigned char length[FRAGMENT_UNITS];   // Length of the tail starting at each unit
+        char pad[FRAGMENT_UNIT - 22];
+        char units[FRAGMENT_UNITS - 1][FRAGMENT_UNIT];  // 480 bytes of tails
+    };  // Overall: 512 bytes
+
+    struct heartyfs_block_ref {
+        unsigned int hash;  // Content hash of the data block, 0 if not indexed
+        int refs;           // Number of inode slots pointing at the block, 0 if untracked
+    };  // Overall: 8 bytes
+
+#define REFS_PER_BLOCK (BLOCK_SIZE / sizeof(struct heartyfs_block_ref))
+#define CHECKSUMS_PER_BLOCK (BLOCK_SIZE / sizeof(unsigned int))
+#define GENERATIONS_PER_BLOCK (BLOCK_SIZE / sizeof(unsigned int))
+
 #endif // HEARTYFS_H
\ No newline at end of file
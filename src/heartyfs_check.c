@@ -9,6 +9,8 @@
  * 
  */
 #include "heartyfs.h"
+#include "op/heartyfs_functions.h"
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -19,7 +21,7 @@
  * @param buffer - the buffer containing the superblock
  */
 void print_superblock(void *buffer) {
-    struct heartyfs_directory *root = (struct heartyfs_directory *)buffer;
+    struct heartyfs_directory *root = (struct heartyfs_directory *)heartyfs_block(buffer, 0);
     
     printf("Superblock (Root Directory) Contents:\n");
     printf("Type: %d\n", root->type);
@@ -40,7 +42,7 @@ void print_superblock(void *buffer) {
  * @param buffer - the buffer containing the bitmap
  */
 void print_bitmap(void *buffer) {
-    unsigned char *bitmap = (unsigned char *)buffer + BLOCK_SIZE;  // Start of Block 1
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);  // Start of Block 1
     int bitmap_size = (NUM_BLOCK - 2) / 8;  // in bytes, excluding superblock and bitmap block
     
     printf("\nBitmap Contents:\n");
@@ -54,28 +56,135 @@ void print_bitmap(void *buffer) {
     printf("\n");
 }
 
-int main() {
-    printf("heartyfs_check\n");
-    int fd = open(DISK_FILE_PATH, O_RDONLY);
-    if (fd < 0) {
-        perror("Cannot open the disk file");
-        exit(1);
+/**
+ * @brief Print the heartyfs info and, if present, block sharing statistics.
+ * 
+ * @param buffer - the buffer containing the disk image
+ */
+void print_info(void *buffer) {
+    struct heartyfs_info *info = (struct heartyfs_info *)((char *)heartyfs_block(buffer, 1) + INFO_OFFSET);
+    if (info->magic != HEARTYFS_MAGIC) {
+        printf("\nInfo: not present (image predates heartyfs_info)\n");
+        return;
+    }
+
+    printf("\nInfo:\n");
+    printf("Blocks: %d\n", info->num_blocks);
+    printf("Dedup: %s\n", (info->features & HEARTYFS_FEATURE_DEDUP) ? "on" : "off");
+    printf("Checksums: %s\n", (info->features & HEARTYFS_FEATURE_CHECKSUM) ? "on" : "off");
+    if (info->features & HEARTYFS_FEATURE_FRAGMENTS) {
+        printf("Tail packing: on, current fragment block %d\n", info->fragment_block);
+    } else {
+        printf("Tail packing: off\n");
+    }
+    if (info->features & HEARTYFS_FEATURE_GENERATIONS) {
+        printf("Generations: %u, table blocks %d-%d\n", info->generation, info->generation_table, info->generation_table + info->generation_table_blocks - 1);
+    } else {
+        printf("Generations: off\n");
+    }
+    int stripe_unit;
+    int num_stripes = heartyfs_stripes(&stripe_unit);
+    if (num_stripes > 1) {
+        printf("Striped: %d files, %d blocks per unit\n", num_stripes, stripe_unit);
+    }
+    printf("Host usage: %lld KB of %d KB\n", heartyfs_host_usage() / 1024, info->num_blocks * BLOCK_SIZE / 1024);
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
+    printf("Block groups: %d of %d blocks, free:", NUM_GROUPS, BLOCKS_PER_GROUP);
+    for (int group = 0; group < NUM_GROUPS; group++) {
+        int free_blocks = 0;
+        for (int i = group * BLOCKS_PER_GROUP; i < (group + 1) * BLOCKS_PER_GROUP; i++) {
+            free_blocks += (i >= 2 && (bitmap[i/8] & (1 << (7 - i%8)))) ? 1 : 0;
+        }
+        printf(" %d", free_blocks);
+    }
+    printf("\n");
+    if (info->ref_table == -1) {
+        return;
     }
 
-    void *buffer = mmap(NULL, DISK_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("Cannot map the disk file onto memory");
-        close(fd);
-        exit(1);
+    int tracked = 0;
+    int shared = 0;
+    int saved = 0;
+    for (int i = 0; i < info->num_blocks; i++) {
+        struct heartyfs_block_ref *ref = get_block_ref(buffer, i);
+        if (ref->refs > 0) {
+            tracked++;
+        }
+        if (ref->refs > 1) {
+            shared++;
+            saved += ref->refs - 1;
+        }
+    }
+    printf("Reference table: blocks %d-%d\n", info->ref_table, info->ref_table + info->ref_table_blocks - 1);
+    printf("Tracked data blocks: %d, shared: %d, blocks saved: %d\n", tracked, shared, saved);
+}
+
+/**
+ * @brief Add the data blocks of a walked file to the list, each shared block once
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param entry - The entry being visited
+ * @param state - The block_list of data blocks
+ */
+void collect_data_blocks(void *buffer, const struct heartyfs_walk_entry *entry, void *state) {
+    static unsigned char seen[NUM_BLOCK];
+    if (entry->info == ENTRY_INFO_DIRECTORY) {
+        return;
+    }
+    struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, entry->block_id);
+    for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+        int block_id = inode->data_blocks[i];
+        if (block_id == HOLE_BLOCK) {
+            continue;
+        }
+        block_id = data_block_of(block_id);
+        if (!seen[block_id]) {
+            seen[block_id] = 1;
+            block_list_add(state, block_id);
+        }
+    }
+}
+
+/**
+ * @brief Verify the checksum of every data block in the file system, if checksums are on.
+ *
+ * @param buffer - the buffer containing the disk image
+ */
+void print_checksums(void *buffer) {
+    struct heartyfs_info *info = get_info((unsigned char *)heartyfs_block(buffer, 1));
+    if (info == NULL || !(info->features & HEARTYFS_FEATURE_CHECKSUM)) {
+        return;
+    }
+
+    struct heartyfs_block_list blocks = {0};
+    void *state = &blocks;
+    if (heartyfs_walk(buffer, "/", 1, collect_data_blocks, &state) == -1) {
+        return;
+    }
+    int bad_block = -1;
+    int bad = verify_data_blocks(buffer, blocks.blocks, blocks.count, &bad_block);
+    printf("Checksum table: blocks %d-%d\n", info->checksum_table, info->checksum_table + info->checksum_table_blocks - 1);
+    printf("Checksums: %d blocks verified, %d corrupted\n", blocks.count, bad);
+    if (bad > 0) {
+        printf("First corrupted block: %d\n", bad_block);
+    }
+    free(blocks.blocks);
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    printf("heartyfs_check\n");
+    void *buffer = heartyfs_mount(HEARTYFS_RDONLY);
+    if (buffer == NULL) {
+        return 1;
     }
 
     print_superblock(buffer);
     print_bitmap(buffer);
+    print_info(buffer);
+    print_checksums(buffer);
 
-    if (munmap(buffer, DISK_SIZE) == -1) {
-        perror("Error unmapping file");
-    }
-    close(fd);
+    heartyfs_unmount(buffer);
 
     return 0;
 }
\ No newline at end of file
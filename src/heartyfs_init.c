@@ -11,16 +11,20 @@
  * 
  */
 #include "heartyfs.h"
+#include "op/heartyfs_functions.h"
 #include <string.h>
 #include <unistd.h>
 
+#define DEFAULT_STRIPE_UNIT 64  // 32 KB per backing file before moving to the next
+#define MIN_IMAGE_BLOCKS 64     // Room for the block tables and a few files
+
 /**
  * @brief Initialize the superblock with the root directory.
  * 
  * @param buffer - The buffer containing the disk image
  */
 void init_superblock(void *buffer) {
-    struct heartyfs_directory *root = (struct heartyfs_directory *)buffer;
+    struct heartyfs_directory *root = (struct heartyfs_directory *)heartyfs_block(buffer, 0);
     
     root->type = 1;  // Directory type
     strncpy(root->name, "/", sizeof(root->name));
@@ -33,11 +37,14 @@ void init_superblock(void *buffer) {
     // Initialize .. (parent directory, same as . for root)
     root->entries[1].block_id = 0;
     strncpy(root->entries[1].file_name, "..", sizeof(root->entries[1].file_name));
+    root->entry_info[0] = ENTRY_INFO_DIRECTORY;
+    root->entry_info[1] = ENTRY_INFO_DIRECTORY;
 
     // Clear the rest of the entries
     for (int i = 2; i < 14; i++) {
         root->entries[i].block_id = -1;
         memset(root->entries[i].file_name, 0, sizeof(root->entries[i].file_name));
+        root->entry_info[i] = 0;
     }
 }
 
@@ -45,52 +52,154 @@ void init_superblock(void *buffer) {
  * @brief Initialize the bitmap with all blocks marked as free.
  * 
  * @param buffer - The buffer containing the disk image
+ * @param num_blocks - The number of blocks of the image, the rest stay used
  */
-void init_bitmap(void *buffer) {
-    unsigned char *bitmap = (unsigned char *)buffer + BLOCK_SIZE;  // Start of Block 1
+void init_bitmap(void *buffer, int num_blocks) {
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);  // Start of Block 1
     int bitmap_size = (NUM_BLOCK - 2) / 8;  // in bytes, excluding superblock and bitmap block (block 0 and 1). 1 byte = 8 blocks
     
     memset(bitmap, 0xFF, bitmap_size);  // Set all bits to 1 (free)
 
     // Set first byte of bitmap to 0xFC (11111100) to mark the first two blocks as used (superblock and bitmap)
     bitmap[0] = 0xFC;  // 11111100 in binary
+
+    // Blocks past the end of a smaller image stay used until heartyfs_resize adds them
+    for (int i = num_blocks; i < NUM_BLOCK; i++) {
+        set_block_used(bitmap, i);
+    }
 }   
 
-int main() {
+/**
+ * @brief Initialize the info in the unused half of the bitmap block.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param features - The HEARTYFS_FEATURE_* flags to enable
+ * @param num_blocks - The number of blocks of the image
+ */
+void init_info(void *buffer, int features, int num_blocks) {
+    struct heartyfs_info *info = (struct heartyfs_info *)((char *)heartyfs_block(buffer, 1) + INFO_OFFSET);
+
+    memset(info, 0, BLOCK_SIZE - INFO_OFFSET);
+    info->magic = HEARTYFS_MAGIC;
+    info->num_blocks = num_blocks;
+    info->features = features;
+    info->ref_table = -1;
+    info->ref_table_blocks = 0;
+    info->fragment_block = -1;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
     printf("heartyfs_innit\n");
-    // Open the disk file
-    int fd = open(DISK_FILE_PATH, O_RDWR);
-    if (fd < 0) {
-        perror("Cannot open the disk file\n");
+    int features = HEARTYFS_FEATURE_ENTRY_INFO;
+    char *stripe_paths[HEARTYFS_MAX_STRIPES];
+    int num_stripes = 0;
+    int stripe_unit = DEFAULT_STRIPE_UNIT;
+    int checksums = 0;
+    int generations = 0;
+    int num_blocks = NUM_BLOCK;
+    int opt;
+    while ((opt = getopt(argc, argv, "dctgn:s:u:")) != -1) {
+        if (opt == 'd') {
+            features |= HEARTYFS_FEATURE_DEDUP;
+        } else if (opt == 'c') {
+            checksums = 1;
+        } else if (opt == 't') {
+            features |= HEARTYFS_FEATURE_FRAGMENTS;
+        } else if (opt == 'g') {
+            generations = 1;
+        } else if (opt == 's') {
+            // Comma separated backing files, e.g. one per local disk
+            for (char *path = strtok(optarg, ","); path != NULL; path = strtok(NULL, ",")) {
+                if (num_stripes == HEARTYFS_MAX_STRIPES) {
+                    fprintf(stderr, "Error: At most %d backing files\n", HEARTYFS_MAX_STRIPES);
+                    exit(1);
+                }
+                stripe_paths[num_stripes++] = path;
+            }
+        } else if (opt == 'u') {
+            stripe_unit = atoi(optarg);
+        } else if (opt == 'n') {
+            // Start smaller, heartyfs_resize grows the image later
+            num_blocks = atoi(optarg);
+        } else {
+            fprintf(stderr, "Usage: %s [-d] [-c] [-t] [-g] [-n num_blocks] [-s file,file,... [-u unit_blocks]]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (num_blocks < MIN_IMAGE_BLOCKS || num_blocks > NUM_BLOCK) {
+        fprintf(stderr, "Error: An image has %d to %d blocks\n", MIN_IMAGE_BLOCKS, NUM_BLOCK);
         exit(1);
     }
 
-    // Map the disk file onto memory
-    void *buffer = mmap(NULL, DISK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("Cannot map the disk file onto memory\n");
-        exit(1);
+    // Point the disk file at the backing files before formatting through it
+    if (num_stripes > 0) {
+        if (heartyfs_create_stripes(stripe_paths, num_stripes, stripe_unit) != 0) {
+            exit(1);
+        }
+        printf("Image striped over %d files, %d blocks per stripe unit.\n", num_stripes, stripe_unit);
+    }
+
+    // Open the disk file and map it onto memory
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
+        return 1;
     }
 
     // TODO:
     printf("Disk file mapped to memory successfully.\n");
 
+    // The backing files hold exactly the blocks of the image
+    if (heartyfs_resize_backing(num_blocks) != 0) {
+        exit(1);
+    }
+    if (num_blocks < NUM_BLOCK) {
+        printf("Image holds %d of up to %d blocks.\n", num_blocks, NUM_BLOCK);
+    }
+
     // Initialize superblock and bitmap
     init_superblock(buffer);
-    init_bitmap(buffer);
+    init_bitmap(buffer, num_blocks);
+    init_info(buffer, features, num_blocks);
+
+    // In discard mode whatever the old image held is punched out, so it starts sparse
+    heartyfs_discard_blocks(2, NUM_BLOCK - 2);
+
+    // Dedup keeps a hash and reference count for every block
+    if (features & HEARTYFS_FEATURE_DEDUP) {
+        if (create_ref_table(buffer, (unsigned char *)heartyfs_block(buffer, 1)) != 0) {
+            exit(1);
+        }
+        printf("Block deduplication enabled.\n");
+    }
+
+    if (features & HEARTYFS_FEATURE_FRAGMENTS) {
+        printf("Tail packing enabled.\n");
+    }
+
+    // A CRC32C of every data block, checked on read and by heartyfs_check
+    if (checksums) {
+        if (create_checksum_table(buffer, (unsigned char *)heartyfs_block(buffer, 1)) != 0) {
+            exit(1);
+        }
+        printf("Block checksums enabled.\n");
+    }
+
+    // A generation per inode and directory, for incremental exports
+    if (generations) {
+        if (create_generation_table(buffer, (unsigned char *)heartyfs_block(buffer, 1)) != 0) {
+            exit(1);
+        }
+        printf("Change generations enabled.\n");
+    }
 
     printf("Superblock and bitmap initialized.\n");
 
     // Sync changes to disk
-    if (msync(buffer, DISK_SIZE, MS_SYNC) == -1) {
-        perror("Error syncing changes to disk\n");
-    }
+    heartyfs_sync(buffer);
 
     // Unmap the file and close
-    if (munmap(buffer, DISK_SIZE) == -1) {
-        perror("Error unmapping file\n");
-    }
-    close(fd);
+    heartyfs_unmount(buffer);
 
     printf("heartyfs initialized successfully.\n");
     return 0;
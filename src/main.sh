@@ -1,2 +1,2 @@
-gcc -o heartyfs_init heartyfs_init.c
+gcc -pthread -o heartyfs_init heartyfs_init.c op/heartyfs_functions.c op/heartyfs_disk.c op/heartyfs_checksum.c op/heartyfs_trace.c
 ./heartyfs_init
\ No newline at end of file
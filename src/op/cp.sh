@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_cp heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_cp.c 
+bin/heartyfs_cp /dir1/dir2/dir3/abc.xyz /dir1/abc.xyz
\ No newline at end of file
@@ -1,2 +1,2 @@
-gcc -o bin/heartyfs_creat heartyfs_functions.c heartyfs_creat.c 
+gcc -pthread -o bin/heartyfs_creat heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_creat.c 
 bin/heartyfs_creat /dir1/dir2/dir3/abc.xyz
\ No newline at end of file
@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_defrag heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_defrag.c 
+bin/heartyfs_defrag
\ No newline at end of file
@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_du heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_walk.c heartyfs_du.c 
+bin/heartyfs_du /dir1/
\ No newline at end of file
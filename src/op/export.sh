@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_export heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_walk.c heartyfs_output.c heartyfs_export.c 
+bin/heartyfs_export / > /tmp/heartyfs.tar
\ No newline at end of file
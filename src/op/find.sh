@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_find heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_walk.c heartyfs_find.c 
+bin/heartyfs_find /dir1/ -name "*.xyz" -type f
\ No newline at end of file
@@ -0,0 +1,241 @@
+/**
+ * @file heartyfs_batch.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file reads many files of the heartyfs file system in one call. The
+ * paths are sorted so that paths sharing a directory prefix are next to each other and
+ * each shared directory is looked up once. The data blocks of all files are then
+ * verified and copied in physical order, with the block layer reading ahead each run.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_PREFETCH_BLOCKS 128   // Blocks read ahead at a time, half the smallest buffer cache
+#define BATCH_MAX_DEPTH (HEARTYFS_PATH_MAX / 2)
+
+// One data block to copy, sorted by its place on the image
+struct batch_block {
+    int block_id;
+    int file;       // Index into the request
+    int chunk;      // Index into the file's data_blocks
+    int entry;      // The data_blocks[] value, a packed tail lives inside block_id
+};
+
+static const struct heartyfs_batch_file *sort_files;
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(sort_files[*(const int *)a].path, sort_files[*(const int *)b].path);
+}
+
+static int compare_batch_blocks(const void *a, const void *b) {
+    const struct batch_block *x = a;
+    const struct batch_block *y = b;
+    return (x->block_id != y->block_id) ? x->block_id - y->block_id : x->file - y->file;
+}
+
+/**
+ * @brief Look a name up in one directory
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param dir_block_id - The directory
+ * @param name - The name
+ * @return int - The block number of the entry, -1 if there is none
+ */
+static int lookup_entry(void *buffer, int dir_block_id, const char *name) {
+    struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(buffer, dir_block_id);
+    for (int i = 0; i < dir->size; i++) {
+        if (strcmp(dir->entries[i].file_name, name) == 0) {
+            return dir->entries[i].block_id;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Resolve the inode of every path. Paths are taken in sorted order and the
+ * directories resolved for the previous path are reused for the common prefix.
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param files - The request
+ * @param count - The number of files
+ * @param inodes - Filled with the inode block of each file, -1 if it was not found
+ */
+static void resolve_paths(void *buffer, const struct heartyfs_batch_file *files, int count, int *inodes) {
+    int *order = malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    sort_files = files;
+    qsort(order, count, sizeof(int), compare_paths);
+
+    // The directories along the previous path: names and the block each resolved to
+    static char cached_names[BATCH_MAX_DEPTH][FILENAME_MAXLEN];
+    static int cached_blocks[BATCH_MAX_DEPTH];
+    int cached_depth = 0;
+
+    for (int n = 0; n < count; n++) {
+        int file = order[n];
+        inodes[file] = -1;
+        char path[HEARTYFS_PATH_MAX];
+        snprintf(path, sizeof(path), "%s", files[file].path);
+        char *names[BATCH_MAX_DEPTH + 1];
+        int depth = 0;
+        char *save;
+        for (char *name = strtok_r(path, "/", &save); name != NULL && depth <= BATCH_MAX_DEPTH; name = strtok_r(NULL, "/", &save)) {
+            names[depth++] = name;
+        }
+        if (depth == 0 || depth > BATCH_MAX_DEPTH) {
+            continue;
+        }
+
+        // Reuse the directories this path shares with the previous one
+        int shared = 0;
+        while (shared < cached_depth && shared < depth - 1 && strcmp(cached_names[shared], names[shared]) == 0) {
+            shared++;
+        }
+        int dir_block_id = (shared > 0) ? cached_blocks[shared - 1] : 0;
+        cached_depth = shared;
+        for (int d = shared; d < depth - 1 && dir_block_id != -1; d++) {
+            dir_block_id = lookup_entry(buffer, dir_block_id, names[d]);
+            if (dir_block_id != -1 && ((struct heartyfs_directory *)heartyfs_block(buffer, dir_block_id))->type != 1) {
+                dir_block_id = -1;
+            }
+            if (dir_block_id != -1 && strlen(names[d]) < FILENAME_MAXLEN) {
+                strcpy(cached_names[d], names[d]);
+                cached_blocks[d] = dir_block_id;
+                cached_depth = d + 1;
+            }
+        }
+        if (dir_block_id != -1) {
+            inodes[file] = lookup_entry(buffer, dir_block_id, names[depth - 1]);
+        }
+    }
+    free(order);
+}
+
+/**
+ * @brief Read many files at once. Each file's status is set, and its content is
+ * returned in a buffer of its size (holes read as zeros).
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param files - The files, path set by the caller. Free with heartyfs_batch_free.
+ * @param count - The number of files
+ * @return int - The number of files read
+ */
+int heartyfs_read_batch(void *buffer, struct heartyfs_batch_file *files, int count) {
+    int *inodes = malloc((count + 1) * sizeof(int));
+    resolve_paths(buffer, files, count, inodes);
+
+    // Every data block of every file found, then sorted by block
+    struct batch_block *blocks = NULL;
+    int num_blocks = 0;
+    int capacity = 0;
+    for (int f = 0; f < count; f++) {
+        files[f].data = NULL;
+        files[f].size = 0;
+        files[f].status = HEARTYFS_BATCH_MISSING;
+        if (inodes[f] == -1) {
+            continue;
+        }
+        struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, inodes[f]);
+        if (inode->type != 0) {
+            continue;
+        }
+        files[f].status = HEARTYFS_BATCH_OK;
+        files[f].size = inode->size;
+        files[f].data = calloc(1, inode->size + 1);
+        int num_chunks = (inode->size + DATA_BLOCK_NAME_SIZE - 1) / DATA_BLOCK_NAME_SIZE;
+        for (int i = 0; i < num_chunks && inode->data_blocks[i] != -1; i++) {
+            if (inode->data_blocks[i] == HOLE_BLOCK) {
+                continue;
+            }
+            if (num_blocks == capacity) {
+                capacity = (capacity == 0) ? 256 : capacity * 2;
+                blocks = realloc(blocks, capacity * sizeof(struct batch_block));
+            }
+            blocks[num_blocks++] = (struct batch_block){ data_block_of(inode->data_blocks[i]), f, i, inode->data_blocks[i] };
+        }
+    }
+    qsort(blocks, num_blocks, sizeof(struct batch_block), compare_batch_blocks);
+
+    int *block_ids = malloc((num_blocks + 1) * sizeof(int));
+    for (int b = 0; b < num_blocks; b++) {
+        block_ids[b] = blocks[b].block_id;
+    }
+
+    // One checksum pass over everything, then block by block only to tell which files are bad
+    int bad_block;
+    if (verify_data_blocks(buffer, block_ids, num_blocks, &bad_block) > 0) {
+        int start = 0;
+        while (start < num_blocks) {
+            int end = start;
+            while (end < num_blocks && blocks[end].block_id == blocks[start].block_id) {
+                end++;
+            }
+            if (verify_data_blocks(buffer, &block_ids[start], 1, &bad_block) > 0) {
+                for (int b = start; b < end; b++) {
+                    files[blocks[b].file].status = HEARTYFS_BATCH_CORRUPTED;
+                }
+            }
+            start = end;
+        }
+    }
+
+    // Copy in physical order, reading ahead one slice at a time
+    for (int start = 0; start < num_blocks; start += BATCH_PREFETCH_BLOCKS) {
+        int end = (start + BATCH_PREFETCH_BLOCKS < num_blocks) ? start + BATCH_PREFETCH_BLOCKS : num_blocks;
+        heartyfs_prefetch_blocks(buffer, &block_ids[start], end - start);
+        for (int b = start; b < end; b++) {
+            struct heartyfs_batch_file *file = &files[blocks[b].file];
+            if (file->status != HEARTYFS_BATCH_OK) {
+                continue;
+            }
+            int stored;
+            const char *data = data_entry_bytes(buffer, blocks[b].entry, &stored);
+            int offset = blocks[b].chunk * DATA_BLOCK_NAME_SIZE;
+            int length = file->size - offset;
+            if (length > DATA_BLOCK_NAME_SIZE) {
+                length = DATA_BLOCK_NAME_SIZE;
+            }
+            if (length > stored) {
+                length = stored;
+            }
+            memcpy(file->data + offset, data, length);
+        }
+    }
+
+    int read = 0;
+    for (int f = 0; f < count; f++) {
+        if (files[f].status != HEARTYFS_BATCH_OK) {
+            free(files[f].data);
+            files[f].data = NULL;
+            files[f].size = 0;
+        } else {
+            read++;
+        }
+    }
+    free(block_ids);
+    free(blocks);
+    free(inodes);
+    return read;
+}
+
+/**
+ * @brief Free the contents returned by heartyfs_read_batch
+ *
+ * @param files - The files
+ * @param count - The number of files
+ */
+void heartyfs_batch_free(struct heartyfs_batch_file *files, int count) {
+    for (int f = 0; f < count; f++) {
+        free(files[f].data);
+        files[f].data = NULL;
+    }
+}
@@ -0,0 +1,285 @@
+/**
+ * @file heartyfs_checksum.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file keeps a CRC32C checksum for every data block in the checksum table,
+ * so torn or corrupted blocks are detected on read and by heartyfs_check.
+ * CRC32C uses the SSE4.2 crc32 instruction on x86-64 or the ARMv8 CRC extension when
+ * the CPU has it, and a slicing-by-8 table otherwise. Verification checksums several
+ * blocks at once: the crc32 instruction has a latency of about three cycles but can
+ * start one per cycle, so three independent blocks are interleaved to keep it busy.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78u  // Reflected Castagnoli polynomial
+
+static uint32_t crc_table[8][256];
+static int crc_hardware = -1;   // -1 until detected
+
+/**
+ * @brief Fill the slicing-by-8 tables of the portable implementation
+ */
+static void crc_table_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        crc_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xFF];
+        }
+    }
+}
+
+static uint32_t crc32c_portable(uint32_t crc, const unsigned char *data, size_t length) {
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        word ^= crc;
+        crc = crc_table[7][word & 0xFF] ^ crc_table[6][(word >> 8) & 0xFF]
+            ^ crc_table[5][(word >> 16) & 0xFF] ^ crc_table[4][(word >> 24) & 0xFF]
+            ^ crc_table[3][(word >> 32) & 0xFF] ^ crc_table[2][(word >> 40) & 0xFF]
+            ^ crc_table[1][(word >> 48) & 0xFF] ^ crc_table[0][word >> 56];
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+#define HW_TARGET __attribute__((target("sse4.2")))
+#define HW_CRC8(crc, byte) _mm_crc32_u8((crc), (byte))
+#define HW_CRC64(crc, word) ((uint32_t)_mm_crc32_u64((crc), (word)))
+#elif defined(__aarch64__)
+#define HW_TARGET __attribute__((target("+crc")))
+#define HW_CRC8(crc, byte) __crc32cb((crc), (byte))
+#define HW_CRC64(crc, word) __crc32cd((crc), (word))
+#endif
+
+#ifdef HW_TARGET
+HW_TARGET static uint32_t crc32c_hardware(uint32_t crc, const unsigned char *data, size_t length) {
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = HW_CRC64(crc, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = HW_CRC8(crc, *data++);
+    }
+    return crc;
+}
+
+// Three whole blocks side by side, each chain hides the latency of the others
+HW_TARGET static void crc32c_hardware_x3(const unsigned char *a, const unsigned char *b, const unsigned char *c, uint32_t *crcs) {
+    uint32_t crc_a = 0xFFFFFFFFu;
+    uint32_t crc_b = 0xFFFFFFFFu;
+    uint32_t crc_c = 0xFFFFFFFFu;
+    for (int i = 0; i < BLOCK_SIZE; i += 8) {
+        uint64_t word_a, word_b, word_c;
+        memcpy(&word_a, a + i, 8);
+        memcpy(&word_b, b + i, 8);
+        memcpy(&word_c, c + i, 8);
+        crc_a = HW_CRC64(crc_a, word_a);
+        crc_b = HW_CRC64(crc_b, word_b);
+        crc_c = HW_CRC64(crc_c, word_c);
+    }
+    crcs[0] = ~crc_a;
+    crcs[1] = ~crc_b;
+    crcs[2] = ~crc_c;
+}
+#endif
+
+/**
+ * @brief Pick the implementation for this CPU, once
+ */
+static void crc_detect(void) {
+    if (crc_hardware != -1) {
+        return;
+    }
+    crc_hardware = 0;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    crc_hardware = __builtin_cpu_supports("sse4.2");
+#elif defined(__aarch64__)
+    crc_hardware = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+    if (!crc_hardware) {
+        crc_table_init();
+    }
+}
+
+/**
+ * @brief Compute the CRC32C (Castagnoli) of a buffer
+ *
+ * @param data - The bytes
+ * @param length - The number of bytes
+ * @return unsigned int - The CRC32C
+ */
+unsigned int crc32c(const void *data, size_t length) {
+    crc_detect();
+#ifdef HW_TARGET
+    if (crc_hardware) {
+        return ~crc32c_hardware(0xFFFFFFFFu, data, length);
+    }
+#endif
+    return ~crc32c_portable(0xFFFFFFFFu, data, length);
+}
+
+/**
+ * @brief Compute the CRC32C of many whole blocks
+ *
+ * @param blocks - The blocks
+ * @param count - The number of blocks
+ * @param crcs - Filled with the CRC32C of each block
+ */
+void crc32c_blocks(const void *const *blocks, int count, unsigned int *crcs) {
+    crc_detect();
+    int i = 0;
+#ifdef HW_TARGET
+    if (crc_hardware) {
+        for (; i + 3 <= count; i += 3) {
+            crc32c_hardware_x3(blocks[i], blocks[i + 1], blocks[i + 2], crcs + i);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        crcs[i] = crc32c(blocks[i], BLOCK_SIZE);
+    }
+}
+
+/**
+ * @brief Turn a CRC into the value stored in the checksum table, where 0 means none
+ *
+ * @param crc - The CRC32C of the block
+ * @return unsigned int - The stored value, never 0
+ */
+static unsigned int stored_checksum(unsigned int crc) {
+    return (crc == 0) ? 1 : crc;
+}
+
+/**
+ * @brief Allocate and clear the checksum table
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @return int - 0 if successful, -1 if failed
+ */
+int create_checksum_table(void *buffer, unsigned char *bitmap) {
+    struct heartyfs_info *info = get_info(bitmap);
+    if (info == NULL) {
+        fprintf(stderr, "Error: heartyfs info is missing, re-run heartyfs_init\n");
+        return -1;
+    }
+    if (info->features & HEARTYFS_FEATURE_CHECKSUM) {
+        return 0;
+    }
+
+    int table_blocks = (NUM_BLOCK + CHECKSUMS_PER_BLOCK - 1) / CHECKSUMS_PER_BLOCK;
+    int start = find_free_run(bitmap, table_blocks);
+    if (start == -1) {
+        fprintf(stderr, "Error: No room for the checksum table\n");
+        return -1;
+    }
+
+    for (int i = 0; i < table_blocks; i++) {
+        set_block_used(bitmap, start + i);
+        memset(heartyfs_block(buffer, start + i), 0, BLOCK_SIZE);
+    }
+    info->checksum_table = start;
+    info->checksum_table_blocks = table_blocks;
+    info->features |= HEARTYFS_FEATURE_CHECKSUM;
+    return 0;
+}
+
+/**
+ * @brief Get the checksum table entry of a block
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param block_id - The block number to look up
+ * @return unsigned int* - The entry (0 if no checksum is recorded), NULL if the image has no checksum table
+ */
+unsigned int *get_block_checksum(void *buffer, int block_id) {
+    struct heartyfs_info *info = get_info((unsigned char *)heartyfs_block(buffer, 1));
+    if (info == NULL || !(info->features & HEARTYFS_FEATURE_CHECKSUM)) {
+        return NULL;
+    }
+    unsigned int *table = (unsigned int *)heartyfs_block(buffer, info->checksum_table + block_id / CHECKSUMS_PER_BLOCK);
+    return &table[block_id % CHECKSUMS_PER_BLOCK];
+}
+
+/**
+ * @brief Record the checksum of a data block that was just written
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param block_id - The data block
+ */
+void record_block_checksum(void *buffer, int block_id) {
+    if (get_block_checksum(buffer, block_id) == NULL) {
+        return;  // No checksum table, skip the CRC
+    }
+    unsigned int crc = crc32c(heartyfs_block(buffer, block_id), BLOCK_SIZE);
+    // Looked up again, reading the data block may have moved the table block
+    *get_block_checksum(buffer, block_id) = stored_checksum(crc);
+}
+
+/**
+ * @brief Verify the checksums of many data blocks in one batch. Blocks without a
+ * recorded checksum are skipped.
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param blocks - The data blocks
+ * @param count - The number of blocks
+ * @param bad_block - Set to the first corrupted block, if any
+ * @return int - The number of corrupted blocks
+ */
+int verify_data_blocks(void *buffer, const int *blocks, int count, int *bad_block) {
+    if (get_block_checksum(buffer, 0) == NULL) {
+        return 0;
+    }
+
+    // Checksum in batches small enough that the block pointers stay cached
+    enum { BATCH = 48 };
+    const void *data[BATCH];
+    unsigned int crcs[BATCH];
+    int bad = 0;
+    for (int start = 0; start < count; start += BATCH) {
+        int n = (count - start > BATCH) ? BATCH : count - start;
+        for (int i = 0; i < n; i++) {
+            data[i] = heartyfs_block(buffer, blocks[start + i]);
+        }
+        crc32c_blocks(data, n, crcs);
+        for (int i = 0; i < n; i++) {
+            unsigned int expected = *get_block_checksum(buffer, blocks[start + i]);
+            if (expected != 0 && expected != stored_checksum(crcs[i])) {
+                if (bad++ == 0) {
+                    *bad_block = blocks[start + i];
+                }
+            }
+        }
+    }
+    return bad;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file heartyfs_cp.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file clones a file in the heartyfs file system by sharing its data blocks.
+ * @version 0.1
+ * @date 2024-10-03
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <libgen.h>
+
+/**
+ * @brief Copy a file by cloning its inode. Only the inode is written, the data
+ * blocks are shared and copied on a later write.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param src_path - The path of the file to copy
+ * @param dst_path - The path of the copy
+ * @return int - 0 if successful, -1 if failed
+ */
+int copy_file(void *buffer, unsigned char *bitmap, const char *src_path, const char *dst_path) {
+    struct heartyfs_inode *src;
+    int src_block_id = find_inode_by_path(buffer, src_path, &src);
+    if (src_block_id == -1) {
+        fprintf(stderr, "Error: File %s does not exist\n", src_path);
+        return -1;
+    }
+    if (src->type != 0) {
+        fprintf(stderr, "Error: %s is not a regular file\n", src_path);
+        return -1;
+    }
+
+    char *path_copy = strdup(dst_path);
+    char *parent_path = dirname(strdup(path_copy));
+    char *file_name = basename(path_copy);
+
+    struct heartyfs_directory *parent_dir;
+    int parent_block_id = find_directory_by_path(buffer, parent_path, &parent_dir);
+    if (parent_block_id == -1) {
+        fprintf(stderr, "Error: Parent directory %s does not exist\n", parent_path);
+        free(path_copy);
+        free(parent_path);
+        return -1;
+    }
+    if (parent_dir->size >= DIR_MAX_ENTRIES) {
+        fprintf(stderr, "Error: Parent directory %s is full\n", parent_path);
+        free(path_copy);
+        free(parent_path);
+        return -1;
+    }
+
+    int block_id = clone_inode(buffer, bitmap, src_block_id, file_name, parent_block_id);
+    if (block_id == -1 || add_directory_entry(parent_dir, block_id, file_name, entry_info_of(heartyfs_block(buffer, block_id))) != 0) {
+        if (block_id != -1) {
+            struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, block_id);
+            release_inode_blocks(buffer, bitmap, inode);
+            heartyfs_clear_blocks(buffer, block_id, 1);
+            set_block_free(bitmap, block_id);
+        }
+        free(path_copy);
+        free(parent_path);
+        return -1;
+    }
+
+    stamp_generation(buffer, block_id, parent_block_id);
+    free(path_copy);
+    free(parent_path);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    printf("heartyfs_cp\n");
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <src_file_path> <dst_file_path>\n", argv[0]);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
+
+    if (copy_file(buffer, bitmap, argv[1], argv[2]) == 0) {
+        printf("Success: File %s copied to %s successfully\n", argv[1], argv[2]);
+    } else {
+        fprintf(stderr, "Error: Failed to copy file %s to %s\n", argv[1], argv[2]);
+    }
+
+    heartyfs_sync(buffer);
+
+    heartyfs_unmount(buffer);
+
+    return 0;
+}
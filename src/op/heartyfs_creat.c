@@ -27,10 +27,11 @@
  * @return int - The block number of the directory, -1 if not found
  */
 int find_directory(void *buffer, const char *path, struct heartyfs_directory **dir) {
+    heartyfs_phase_begin(HEARTYFS_PHASE_RESOLVE);
     char *path_copy = strdup(path);
     char *parent_path = dirname(strdup(path_copy));
 
-    struct heartyfs_directory *current = buffer;
+    struct heartyfs_directory *current = heartyfs_block(buffer, 0);
     int current_block_id = 0;
 
     char *token = strtok(parent_path, "/");
@@ -39,7 +40,7 @@ int find_directory(void *buffer, const char *path, struct heartyfs_directory **d
         for (int i = 0; i < current->size; i++) {
             if (strcmp(current->entries[i].file_name, token) == 0) {
                 current_block_id = current->entries[i].block_id;
-                current = (struct heartyfs_directory *)((char *)buffer + current_block_id * BLOCK_SIZE);
+                current = (struct heartyfs_directory *)heartyfs_block(buffer, current_block_id);
                 found = 1;
                 break;
             }
@@ -47,6 +48,7 @@ int find_directory(void *buffer, const char *path, struct heartyfs_directory **d
         if (!found) {
             free(path_copy);
             free(parent_path);
+            heartyfs_phase_end();
             return -1;
         }
         token = strtok(NULL, "/");
@@ -55,6 +57,7 @@ int find_directory(void *buffer, const char *path, struct heartyfs_directory **d
     *dir = current;
     free(path_copy);
     free(parent_path);
+    heartyfs_phase_end();
     return current_block_id;
 }
 
@@ -92,8 +95,8 @@ int create_file(void *buffer, unsigned char *bitmap, const char *path) {
         return -1;
     }
 
-    // Find a free block for the inode
-    int inode_block_id = find_free_block(bitmap);
+    // Find a free block for the inode, in the block group of its directory
+    int inode_block_id = find_free_block_near(bitmap, parent_block_id);
     if (inode_block_id == -1) {
         fprintf(stderr, "Error: No free blocks available\n");
         free(path_copy);
@@ -104,7 +107,7 @@ int create_file(void *buffer, unsigned char *bitmap, const char *path) {
     set_block_used(bitmap, inode_block_id);
 
     // Initialize the inode
-    struct heartyfs_inode *inode = (struct heartyfs_inode *)((char *)buffer + inode_block_id * BLOCK_SIZE);
+    struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
     inode->type = 0;  // Regular file
     strncpy(inode->name, file_name, sizeof(inode->name) - 1);
     inode->size = 0;
@@ -113,33 +116,28 @@ int create_file(void *buffer, unsigned char *bitmap, const char *path) {
     // Add new entry to parent directory
     parent_dir->entries[parent_dir->size].block_id = inode_block_id;
     strncpy(parent_dir->entries[parent_dir->size].file_name, file_name, sizeof(parent_dir->entries[parent_dir->size].file_name) - 1);
+    parent_dir->entry_info[parent_dir->size] = 0;  // Empty file
     parent_dir->size++;
+    stamp_generation(buffer, inode_block_id, parent_block_id);
 
     free(path_copy);
     return 0;
 }
 
 int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
     printf("heartyfs_creat\n");
     if (argc != 2) {
         fprintf(stderr, "Usage: %s <file_path>\n", argv[0]);
         return 1;
     }
 
-    int fd = open(DISK_FILE_PATH, O_RDWR);
-    if (fd < 0) {
-        perror("Error: Cannot open the disk file");
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
         return 1;
     }
 
-    void *buffer = mmap(NULL, DISK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("Error: Cannot map the disk file onto memory");
-        close(fd);
-        return 1;
-    }
-
-    unsigned char *bitmap = (unsigned char *)buffer + BLOCK_SIZE;
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
 
     if (create_file(buffer, bitmap, argv[1]) == 0) {
         printf("Success: File %s created successfully\n", argv[1]);
@@ -147,14 +145,9 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error: Failed to create file %s\n", argv[1]);
     }
 
-    if (msync(buffer, DISK_SIZE, MS_SYNC) == -1) {
-        perror("Error: Failed to sync changes to disk");
-    }
+    heartyfs_sync(buffer);
 
-    if (munmap(buffer, DISK_SIZE) == -1) {
-        perror("Error: Failed to unmap file");
-    }
-    close(fd);
+    heartyfs_unmount(buffer);
 
     return 0;
 }
\ No newline at end of file
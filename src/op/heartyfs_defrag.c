@@ -0,0 +1,332 @@
+/**
+ * @file heartyfs_defrag.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file defragments the heartyfs file system. Blocks are laid out again in
+ * tree order from the front of the image: each directory, then for each of its files
+ * the inode followed by its data blocks in order, then its subdirectories. Live blocks
+ * end up packed at the front and free space becomes one run at the end.
+ *
+ * Blocks are moved one at a time: the content is copied into a free block, the one
+ * pointer to it is switched over and only then the old block is freed, so the image is
+ * consistent after every move. Blocks shared by several inodes, fragment blocks holding
+ * packed tails, the superblock, the bitmap and the reference, checksum and generation
+ * tables never move.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PINNED -2   // owner[] value of a block that never moves
+#define NO_OWNER -1 // owner[] value of a free block
+
+// What the defragmenter knows about every block
+struct defrag_state {
+    void *buffer;
+    unsigned char *bitmap;
+    int owner[NUM_BLOCK];       // The directory or inode pointing at the block
+    int is_data[NUM_BLOCK];     // Data block (owner is an inode) or metadata (owner is a directory)
+    int *order;                 // Blocks in their target order, updated as they move
+    int *item_of_block;         // Index into order of the block, -1 if not planned
+    int count;
+    int moves;
+};
+
+/**
+ * @brief Append a block to the target order
+ *
+ * @param state - The defragmenter state
+ * @param block_id - The block
+ * @param owner - The directory or inode pointing at it
+ * @param is_data - 1 for a data block
+ */
+void plan_block(struct defrag_state *state, int block_id, int owner, int is_data) {
+    state->owner[block_id] = owner;
+    state->is_data[block_id] = is_data;
+    state->item_of_block[block_id] = state->count;
+    state->order[state->count++] = block_id;
+}
+
+/**
+ * @brief Plan a directory subtree: the directory, its files (inode then data), then
+ * its subdirectories
+ *
+ * @param state - The defragmenter state
+ * @param dir_block_id - The directory
+ */
+void plan_directory(struct defrag_state *state, int dir_block_id) {
+    struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(state->buffer, dir_block_id);
+    for (int i = 2; i < dir->size; i++) {
+        int child = dir->entries[i].block_id;
+        struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(state->buffer, child);
+        if (inode->type == 1) {
+            continue;
+        }
+        plan_block(state, child, dir_block_id, 0);
+        for (int j = 0; j < INODE_BLOCKS && inode->data_blocks[j] != -1; j++) {
+            int data_block_id = inode->data_blocks[j];
+            if (data_block_id == HOLE_BLOCK || IS_FRAGMENT(data_block_id) || state->owner[data_block_id] != NO_OWNER) {
+                continue;  // Holes, packed tails, pinned blocks and repeats within the file
+            }
+            struct heartyfs_block_ref *ref = get_block_ref(state->buffer, data_block_id);
+            if (ref != NULL && ref->refs > 1) {
+                state->owner[data_block_id] = PINNED;  // Shared, several inodes point at it
+                continue;
+            }
+            plan_block(state, data_block_id, child, 1);
+        }
+        dir = (struct heartyfs_directory *)heartyfs_block(state->buffer, dir_block_id);
+    }
+    for (int i = 2; i < dir->size; i++) {
+        int child = dir->entries[i].block_id;
+        struct heartyfs_directory *subdir = (struct heartyfs_directory *)heartyfs_block(state->buffer, child);
+        if (subdir->type == 1) {
+            plan_block(state, child, dir_block_id, 0);
+            plan_directory(state, child);
+            dir = (struct heartyfs_directory *)heartyfs_block(state->buffer, dir_block_id);
+        }
+    }
+}
+
+/**
+ * @brief Move a block into a free block and switch its one pointer over
+ *
+ * @param state - The defragmenter state
+ * @param from - The block to move
+ * @param to - The free block receiving it
+ */
+void move_block(struct defrag_state *state, int from, int to) {
+    void *buffer = state->buffer;
+    memcpy(heartyfs_block(buffer, to), heartyfs_block(buffer, from), BLOCK_SIZE);
+    set_block_used(state->bitmap, to);
+
+    // Switch the pointer in the owner over to the copy
+    int owner = state->owner[from];
+    if (state->is_data[from]) {
+        struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, owner);
+        for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+            if (inode->data_blocks[i] == from) {
+                inode->data_blocks[i] = to;
+            }
+        }
+        struct heartyfs_block_ref *ref = get_block_ref(buffer, from);
+        if (ref != NULL) {
+            *get_block_ref(buffer, to) = *ref;
+            ref = get_block_ref(buffer, from);
+            ref->refs = 0;
+            ref->hash = 0;
+        }
+        unsigned int *checksum = get_block_checksum(buffer, from);
+        if (checksum != NULL) {
+            *get_block_checksum(buffer, to) = *checksum;
+            *get_block_checksum(buffer, from) = 0;
+        }
+    } else {
+        // Directories and inodes keep the generation of their last change
+        unsigned int *generation = get_block_generation(buffer, from);
+        if (generation != NULL) {
+            *get_block_generation(buffer, to) = *generation;
+            *get_block_generation(buffer, from) = 0;
+            *get_link_generation(buffer, to) = *get_link_generation(buffer, from);
+            *get_link_generation(buffer, from) = 0;
+        }
+        struct heartyfs_directory *parent = (struct heartyfs_directory *)heartyfs_block(buffer, owner);
+        for (int i = 2; i < parent->size; i++) {
+            if (parent->entries[i].block_id == from) {
+                parent->entries[i].block_id = to;
+            }
+        }
+    }
+
+    // The children of the moved block now have a new owner
+    struct heartyfs_directory *moved = (struct heartyfs_directory *)heartyfs_block(buffer, to);
+    if (state->is_data[from]) {
+        // Data blocks have no children
+    } else if (moved->type == 1) {
+        moved->entries[0].block_id = to;
+        for (int i = 2; i < moved->size; i++) {
+            int child = moved->entries[i].block_id;
+            struct heartyfs_directory *subdir = (struct heartyfs_directory *)heartyfs_block(buffer, child);
+            if (subdir->type == 1) {
+                subdir->entries[1].block_id = to;
+            }
+            if (state->owner[child] != PINNED) {
+                state->owner[child] = to;
+            }
+            moved = (struct heartyfs_directory *)heartyfs_block(buffer, to);
+        }
+    } else {
+        struct heartyfs_inode *inode = (struct heartyfs_inode *)moved;
+        for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+            int data_block_id = inode->data_blocks[i];
+            if (data_block_id != HOLE_BLOCK && !IS_FRAGMENT(data_block_id) && state->owner[data_block_id] != PINNED) {
+                state->owner[data_block_id] = to;
+            }
+        }
+    }
+
+    set_block_free(state->bitmap, from);
+    heartyfs_discard_blocks(from, 1);
+    state->owner[to] = owner;
+    state->is_data[to] = state->is_data[from];
+    state->owner[from] = NO_OWNER;
+    int item = state->item_of_block[from];
+    state->item_of_block[to] = item;
+    state->item_of_block[from] = -1;
+    if (item != -1) {
+        state->order[item] = to;
+    }
+    state->moves++;
+}
+
+/**
+ * @brief Count the runs of free blocks
+ *
+ * @param bitmap - The bitmap containing the block allocation information
+ * @return int - The number of free extents
+ */
+int count_free_extents(unsigned char *bitmap) {
+    int extents = 0;
+    int previous_free = 0;
+    for (int i = 2; i < NUM_BLOCK; i++) {
+        int free_block = (bitmap[i/8] & (1 << (7 - i%8))) != 0;
+        extents += (free_block && !previous_free);
+        previous_free = free_block;
+    }
+    return extents;
+}
+
+/**
+ * @brief Defragment the image
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param max_moves - Stop after this many moves, -1 for no limit
+ * @return int - 0 if successful, -1 if failed
+ */
+int defragment(void *buffer, unsigned char *bitmap, int max_moves) {
+    struct defrag_state *state = calloc(1, sizeof(struct defrag_state));
+    state->buffer = buffer;
+    state->bitmap = bitmap;
+    state->order = malloc(NUM_BLOCK * sizeof(int));
+    state->item_of_block = malloc(NUM_BLOCK * sizeof(int));
+    for (int i = 0; i < NUM_BLOCK; i++) {
+        state->owner[i] = NO_OWNER;
+        state->item_of_block[i] = -1;
+    }
+
+    // The superblock, bitmap and reference, checksum and generation tables stay where they are
+    state->owner[0] = PINNED;
+    state->owner[1] = PINNED;
+    struct heartyfs_info *info = get_info(bitmap);
+    if (info != NULL && info->ref_table != -1) {
+        for (int i = 0; i < info->ref_table_blocks; i++) {
+            state->owner[info->ref_table + i] = PINNED;
+        }
+    }
+    if (info != NULL && (info->features & HEARTYFS_FEATURE_CHECKSUM)) {
+        for (int i = 0; i < info->checksum_table_blocks; i++) {
+            state->owner[info->checksum_table + i] = PINNED;
+        }
+    }
+    if (info != NULL && (info->features & HEARTYFS_FEATURE_GENERATIONS)) {
+        for (int i = 0; i < info->generation_table_blocks; i++) {
+            state->owner[info->generation_table + i] = PINNED;
+        }
+    }
+    plan_directory(state, 0);
+
+    // Used blocks no file or directory points at are left alone
+    for (int i = 2; i < NUM_BLOCK; i++) {
+        if (state->owner[i] == NO_OWNER && !(bitmap[i/8] & (1 << (7 - i%8)))) {
+            state->owner[i] = PINNED;
+        }
+    }
+
+    int extents_before = count_free_extents(bitmap);
+    int cursor = 2;
+    int result = 0;
+    for (int item = 0; item < state->count && state->moves != max_moves; item++) {
+        while (cursor < NUM_BLOCK && state->owner[cursor] == PINNED) {
+            cursor++;
+        }
+        int block_id = state->order[item];
+        if (block_id == cursor) {
+            cursor++;
+            continue;
+        }
+
+        // Make room: whatever sits at the cursor goes to a free block past it
+        if (state->owner[cursor] != NO_OWNER) {
+            int spare = -1;
+            for (int i = cursor + 1; i < NUM_BLOCK && spare == -1; i++) {
+                if (state->owner[i] == NO_OWNER) {
+                    spare = i;
+                }
+            }
+            if (spare == -1) {
+                fprintf(stderr, "Error: No free block left to move blocks through\n");
+                result = -1;
+                break;
+            }
+            move_block(state, cursor, spare);
+            block_id = state->order[item];   // It may have been the block at the cursor's owner
+            if (state->moves == max_moves) {
+                break;
+            }
+        }
+        move_block(state, block_id, cursor);
+        cursor++;
+    }
+
+    printf("Moved %d blocks, free extents %d -> %d\n", state->moves, extents_before, count_free_extents(bitmap));
+    free(state->order);
+    free(state->item_of_block);
+    free(state);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    printf("heartyfs_defrag\n");
+    int max_moves = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0) {
+            max_moves = atoi(optarg);
+        } else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc) {
+        fprintf(stderr, "Usage: %s [-n max_moves]\n", argv[0]);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
+
+    if (defragment(buffer, bitmap, max_moves) == 0) {
+        printf("Success: heartyfs defragmented\n");
+    } else {
+        fprintf(stderr, "Error: Defragmentation stopped early\n");
+    }
+
+    heartyfs_sync(buffer);
+
+    heartyfs_unmount(buffer);
+
+    return 0;
+}
@@ -0,0 +1,1190 @@
+/**
+ * @file heartyfs_disk.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file is the block layer under every tool. Blocks are reached through
+ * heartyfs_block(), backed by one of three engines:
+ *   mmap  - the whole disk file mapped onto memory (default). It applies the
+ *           access-pattern policy: prefetching the blocks of a file being read,
+ *           optional transparent huge pages and keeping the metadata locked in memory.
+ *   pread - a bounded LRU buffer cache filled with batched preadv and written back
+ *           in sorted, coalesced pwritev batches on sync, optionally with O_DIRECT.
+ *   window - an LRU cache of small mappings (windows) over the image. Only the
+ *           windows holding the superblock, bitmap and block tables stay mapped, the
+ *           rest are mapped when a block in them is touched, so the cost of mounting and
+ *           the address space used follow the work done rather than the image size.
+ *           It is opt-in: images are at most NUM_BLOCK blocks (1 MB), which one mmap
+ *           maps whole for less than the first window faults cost.
+ * The image is either the disk file itself or striped over several backing files.
+ * A striped image turns the disk file into a small layout file:
+ *   heartyfs-stripes <unit_blocks>
+ *   <backing file 0>
+ *   <backing file 1>
+ *   ...
+ * Stripe unit k (blocks k*unit .. k*unit+unit-1) lives in backing file k % n, so
+ * a run of blocks is one contiguous range in every backing file it touches.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * The engine and policy can be tuned with environment variables:
+ *   HEARTYFS_ENGINE=mmap|pread|direct|window - choose the engine (direct is pread with O_DIRECT)
+ *   HEARTYFS_CACHE_BLOCKS=N           - buffer cache size of the pread engine in blocks
+ *   HEARTYFS_WINDOWS=N                - number of windows the window engine keeps mapped
+ *   HEARTYFS_WINDOW_BLOCKS=N          - window size in blocks, rounded to a power of two
+ *   HEARTYFS_POPULATE=1  - prefault the whole image when it is mapped (MAP_POPULATE)
+ *   HEARTYFS_HUGEPAGE=1  - ask for transparent huge pages on the image (MADV_HUGEPAGE)
+ *   HEARTYFS_MLOCK=0     - do not lock the superblock, bitmap and hot directories
+ *   HEARTYFS_DISCARD=1   - punch freed blocks out of the backing files on sync
+ *
+ * In discard mode freed blocks are not zeroed block by block. They are queued and on
+ * sync every queued block still free is punched out of its backing file in one
+ * fallocate() per run, so the host only stores live blocks and a free writes no pages.
+ * Punched and never written blocks read back as zeros.
+ */
+#define _GNU_SOURCE // O_DIRECT
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <ctype.h>
+
+#define ENGINE_MMAP 0
+#define ENGINE_PREAD 1
+#define ENGINE_WINDOW 2
+#define DEFAULT_WINDOW_BLOCKS 64
+#define DEFAULT_WINDOWS 256
+#define MIN_WINDOWS 160  // Every block pointer an operation holds may sit in its own window
+#define DEFAULT_CACHE_BLOCKS 512
+#define MIN_CACHE_BLOCKS 256  // An operation holds up to ~150 block pointers at once
+#define STRIPE_HEADER "heartyfs-stripes"
+#define PARALLEL_MIN_BLOCKS 16  // Smaller transfers are not worth a thread per backing file
+
+// One block held by the buffer cache, or one window of the window engine
+struct cache_slot {
+    int block_id;               // -1 if the slot is empty (the window number for windows)
+    int prev;                   // LRU neighbours, the head is the most recently used
+    int next;
+    int pinned;                 // Never evicted (superblock and bitmap)
+    unsigned long long hash;    // Content hash when loaded or last written, tells dirty blocks apart
+    char *data;
+};
+
+// One contiguous range of a transfer inside one backing file
+struct stripe_io {
+    pthread_t thread;
+    int stripe;
+    off_t offset;
+    char *data[NUM_BLOCK];
+    int count;
+    int write_back;
+    int result;
+    int threaded;   // Transferred on its own thread, to be joined
+};
+
+static int disk_fds[HEARTYFS_MAX_STRIPES];
+static int direct_io[HEARTYFS_MAX_STRIPES];
+static int num_stripes = 0;
+static int stripe_unit = NUM_BLOCK;  // Blocks per stripe unit, the whole image if not striped
+static int disk_mode = HEARTYFS_RDONLY;
+static int disk_engine = ENGINE_MMAP;
+static size_t page_size = 0;
+
+static struct cache_slot *slots = NULL;
+static char *arena = NULL;
+static int cache_capacity = 0;
+static int *slot_of_block = NULL;     // Indexed by window number with the window engine
+static int lru_head = -1;
+static int lru_tail = -1;
+static int window_blocks = 0;
+static int window_prot = 0;
+static int window_flags = 0;
+static char cache_handle;   // The buffer handed out by the pread and window engines, never dereferenced
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char *discard_queue = NULL;  // One bit per block freed since the last sync
+
+/**
+ * @brief Check whether an environment flag is set to "1"
+ *
+ * @param name - The name of the environment variable
+ * @param fallback - The value to use when the variable is not set
+ * @return int - 1 if enabled, 0 otherwise
+ */
+static int env_flag(const char *name, int fallback) {
+    const char *value = getenv(name);
+    return (value == NULL) ? fallback : (strcmp(value, "1") == 0);
+}
+
+/**
+ * @brief Round a block range out to whole pages and apply madvise or mlock to it
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param first_block - The first block of the range
+ * @param num_blocks - The number of blocks in the range
+ * @param advice - The madvise advice, -1 to mlock the range instead
+ */
+static void apply_to_blocks(void *buffer, int first_block, int num_blocks, int advice) {
+    size_t start = (size_t)first_block * BLOCK_SIZE;
+    size_t end = (size_t)(first_block + num_blocks) * BLOCK_SIZE;
+    start -= start % page_size;
+    end = (end + page_size - 1) / page_size * page_size;
+    if (end > DISK_SIZE) {
+        end = DISK_SIZE;
+    }
+
+    // Failures only cost performance, so they are not reported
+    if (advice == -1) {
+        mlock((char *)buffer + start, end - start);
+    } else {
+        madvise((char *)buffer + start, end - start, advice);
+    }
+}
+
+/**
+ * @brief Lock the superblock, bitmap, reference table and the root's directories in memory
+ *
+ * @param buffer - The buffer containing the disk image
+ */
+static void lock_metadata(void *buffer) {
+    struct heartyfs_directory *root = (struct heartyfs_directory *)buffer;
+    if (root->type != 1) {
+        return;  // Not initialized yet
+    }
+
+    apply_to_blocks(buffer, 0, 2, -1);
+
+    struct heartyfs_info *info = get_info((unsigned char *)buffer + BLOCK_SIZE);
+    if (info != NULL && info->ref_table != -1) {
+        apply_to_blocks(buffer, info->ref_table, info->ref_table_blocks, -1);
+    }
+
+    // Every path lookup starts at the root, so its subdirectories are the hottest blocks
+    for (int i = 2; i < root->size && i < DIR_MAX_ENTRIES; i++) {
+        int block_id = root->entries[i].block_id;
+        struct heartyfs_directory *dir = (struct heartyfs_directory *)((char *)buffer + block_id * BLOCK_SIZE);
+        if (block_id > 1 && block_id < NUM_BLOCK && dir->type == 1) {
+            apply_to_blocks(buffer, block_id, 1, -1);
+        }
+    }
+}
+
+static unsigned long long hash_block_content(const char *data) {
+    unsigned long long hash = 14695981039346656037ull;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static void lru_unlink(int slot) {
+    if (slots[slot].prev != -1) {
+        slots[slots[slot].prev].next = slots[slot].next;
+    } else {
+        lru_head = slots[slot].next;
+    }
+    if (slots[slot].next != -1) {
+        slots[slots[slot].next].prev = slots[slot].prev;
+    } else {
+        lru_tail = slots[slot].prev;
+    }
+}
+
+static void lru_push_front(int slot) {
+    slots[slot].prev = -1;
+    slots[slot].next = lru_head;
+    if (lru_head != -1) {
+        slots[lru_head].prev = slot;
+    }
+    lru_head = slot;
+    if (lru_tail == -1) {
+        lru_tail = slot;
+    }
+}
+
+/**
+ * @brief Find where a block is stored
+ *
+ * @param block_id - The block number
+ * @param stripe - Set to the backing file holding the block
+ * @return off_t - The byte offset of the block in that backing file
+ */
+off_t heartyfs_block_location(int block_id, int *stripe) {
+    int unit = block_id / stripe_unit;
+    *stripe = unit % num_stripes;
+    return ((off_t)(unit / num_stripes) * stripe_unit + block_id % stripe_unit) * BLOCK_SIZE;
+}
+
+/**
+ * @brief Get the layout of the mounted image
+ *
+ * @param unit_blocks - Set to the stripe unit in blocks
+ * @return int - The number of backing files
+ */
+int heartyfs_stripes(int *unit_blocks) {
+    *unit_blocks = stripe_unit;
+    return num_stripes;
+}
+
+/**
+ * @brief Read a stripe layout from the start of the disk file
+ *
+ * @param fd - The open disk file
+ * @param paths - Filled with the backing file paths, to be freed by the caller
+ * @param unit_blocks - Set to the stripe unit in blocks
+ * @return int - The number of backing files, 0 if the disk file is the image itself, -1 if malformed
+ */
+static int read_stripe_layout(int fd, char *paths[HEARTYFS_MAX_STRIPES], int *unit_blocks) {
+    char text[HEARTYFS_MAX_STRIPES * (PATH_MAX + 1) + 64];
+    ssize_t length = pread(fd, text, sizeof(text) - 1, 0);
+    if (length < (ssize_t)strlen(STRIPE_HEADER) || strncmp(text, STRIPE_HEADER, strlen(STRIPE_HEADER)) != 0) {
+        return 0;
+    }
+    text[length] = '\0';
+
+    char *save;
+    char *line = strtok_r(text, "\n", &save);
+    if (sscanf(line + strlen(STRIPE_HEADER), "%d", unit_blocks) != 1 || *unit_blocks <= 0 || NUM_BLOCK % *unit_blocks != 0) {
+        fprintf(stderr, "Error: Malformed stripe layout in %s\n", DISK_FILE_PATH);
+        return -1;
+    }
+    int count = 0;
+    while ((line = strtok_r(NULL, "\n", &save)) != NULL && isgraph((unsigned char)line[0])) {
+        if (count == HEARTYFS_MAX_STRIPES) {
+            fprintf(stderr, "Error: Too many backing files in %s\n", DISK_FILE_PATH);
+            return -1;
+        }
+        paths[count++] = strdup(line);
+    }
+    if (count == 0) {
+        fprintf(stderr, "Error: Malformed stripe layout in %s\n", DISK_FILE_PATH);
+        return -1;
+    }
+    return count;
+}
+
+/**
+ * @brief Create the backing files of a striped image and point the disk file at them.
+ * The backing files are created empty (all zeros), heartyfs_init formats them afterwards.
+ *
+ * @param paths - The backing file paths
+ * @param count - The number of backing files
+ * @param unit_blocks - The stripe unit in blocks, a whole number of pages that divides the image
+ * @return int - 0 if successful, -1 if failed
+ */
+int heartyfs_create_stripes(char **paths, int count, int unit_blocks) {
+    int page_blocks = sysconf(_SC_PAGESIZE) / BLOCK_SIZE;
+    if (count < 1 || count > HEARTYFS_MAX_STRIPES) {
+        fprintf(stderr, "Error: An image can be striped over 1 to %d files\n", HEARTYFS_MAX_STRIPES);
+        return -1;
+    }
+    if (unit_blocks <= 0 || unit_blocks % page_blocks != 0 || NUM_BLOCK % unit_blocks != 0) {
+        fprintf(stderr, "Error: The stripe unit must be a multiple of %d blocks that divides %d\n", page_blocks, NUM_BLOCK);
+        return -1;
+    }
+
+    int num_units = NUM_BLOCK / unit_blocks;
+    for (int i = 0; i < count; i++) {
+        if (paths[i][0] != '/' || strcmp(paths[i], DISK_FILE_PATH) == 0) {
+            fprintf(stderr, "Error: Backing file %s must be an absolute path other than %s\n", paths[i], DISK_FILE_PATH);
+            return -1;
+        }
+        int fd = open(paths[i], O_RDWR | O_CREAT | O_TRUNC, 0644);
+        int units = num_units / count + (i < num_units % count);
+        if (fd < 0 || ftruncate(fd, (off_t)units * unit_blocks * BLOCK_SIZE) == -1) {
+            fprintf(stderr, "Error: Cannot create backing file %s\n", paths[i]);
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        close(fd);
+    }
+
+    FILE *layout = fopen(DISK_FILE_PATH, "w");
+    if (layout == NULL) {
+        perror("Error: Cannot write the stripe layout");
+        return -1;
+    }
+    fprintf(layout, "%s %d\n", STRIPE_HEADER, unit_blocks);
+    for (int i = 0; i < count; i++) {
+        fprintf(layout, "%s\n", paths[i]);
+    }
+    return (fclose(layout) == 0) ? 0 : -1;
+}
+
+static void close_backing_files(void) {
+    for (int i = 0; i < num_stripes; i++) {
+        if (disk_fds[i] >= 0) {
+            close(disk_fds[i]);
+        }
+        disk_fds[i] = -1;
+    }
+    num_stripes = 0;
+}
+
+/**
+ * @brief Open the disk file, or every backing file if the image is striped
+ *
+ * @param open_flags - O_RDONLY or O_RDWR
+ * @param use_direct - 1 to try O_DIRECT
+ * @return int - 0 if successful, -1 if failed
+ */
+static int open_backing_files(int open_flags, int use_direct) {
+    int fd = open(DISK_FILE_PATH, open_flags);
+    if (fd < 0) {
+        perror("Error: Cannot open the disk file");
+        return -1;
+    }
+
+    char *paths[HEARTYFS_MAX_STRIPES];
+    int count = read_stripe_layout(fd, paths, &stripe_unit);
+    if (count == -1) {
+        close(fd);
+        return -1;
+    }
+    if (count == 0) {
+        // The disk file is the image, reopen it with O_DIRECT if asked
+        count = 1;
+        stripe_unit = NUM_BLOCK;
+        paths[0] = strdup(DISK_FILE_PATH);
+    }
+    close(fd);
+
+    int result = 0;
+    num_stripes = count;
+    for (int i = 0; i < count; i++) {
+        direct_io[i] = use_direct;
+        disk_fds[i] = open(paths[i], open_flags | (use_direct ? O_DIRECT : 0));
+        if (disk_fds[i] < 0 && use_direct) {
+            fprintf(stderr, "Warning: O_DIRECT is not supported here, using buffered I/O\n");
+            direct_io[i] = 0;
+            disk_fds[i] = open(paths[i], open_flags);
+        }
+        if (disk_fds[i] < 0) {
+            fprintf(stderr, "Error: Cannot open backing file %s\n", paths[i]);
+            result = -1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    if (result != 0) {
+        close_backing_files();
+    }
+    return result;
+}
+
+/**
+ * @brief Read or write a contiguous range of one backing file with vectored calls.
+ * O_DIRECT is dropped for that file if the device refuses our alignment.
+ *
+ * @param arg - The stripe_io describing the range, its result is set
+ * @return void* - NULL
+ */
+static void *transfer_stripe(void *arg) {
+    struct stripe_io *io = arg;
+    int fd = disk_fds[io->stripe];
+    struct iovec iov[IOV_MAX];
+    int done = 0;
+    io->result = 0;
+    while (done < io->count) {
+        int batch = (io->count - done > IOV_MAX) ? IOV_MAX : io->count - done;
+        for (int i = 0; i < batch; i++) {
+            iov[i].iov_base = io->data[done + i];
+            iov[i].iov_len = BLOCK_SIZE;
+        }
+        off_t offset = io->offset + (off_t)done * BLOCK_SIZE;
+        ssize_t bytes = io->write_back ? pwritev(fd, iov, batch, offset) : preadv(fd, iov, batch, offset);
+        if (bytes < 0 && errno == EINVAL && direct_io[io->stripe]) {
+            fprintf(stderr, "Warning: O_DIRECT is not supported here, using buffered I/O\n");
+            direct_io[io->stripe] = 0;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            continue;
+        }
+        if (bytes != (ssize_t)batch * BLOCK_SIZE) {
+            perror(io->write_back ? "Error: Failed to write blocks" : "Error: Failed to read blocks");
+            io->result = -1;
+            return NULL;
+        }
+        done += batch;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Read or write a run of consecutive blocks. The run is split into one range
+ * per backing file, and the ranges are transferred in parallel when it is large.
+ *
+ * @param first_block - The first block of the run
+ * @param data - The cache buffers of the blocks, in block order
+ * @param count - The number of blocks in the run
+ * @param write_back - 1 to write, 0 to read
+ * @return int - 0 if successful, -1 if failed
+ */
+static int transfer_run(int first_block, char **data, int count, int write_back) {
+    if (num_stripes == 1) {
+        struct stripe_io io = { .stripe = 0, .offset = (off_t)first_block * BLOCK_SIZE, .count = count, .write_back = write_back };
+        memcpy(io.data, data, count * sizeof(char *));
+        transfer_stripe(&io);
+        return io.result;
+    }
+
+    struct stripe_io *ios = calloc(num_stripes, sizeof(struct stripe_io));
+    int used[HEARTYFS_MAX_STRIPES];
+    int num_used = 0;
+    for (int i = 0; i < count; i++) {
+        int stripe;
+        off_t offset = heartyfs_block_location(first_block + i, &stripe);
+        struct stripe_io *io = &ios[stripe];
+        if (io->count == 0) {
+            io->stripe = stripe;
+            io->offset = offset;
+            io->write_back = write_back;
+            used[num_used++] = stripe;
+        }
+        io->data[io->count++] = data[i];
+    }
+
+    int parallel = (num_used > 1 && count >= PARALLEL_MIN_BLOCKS);
+    for (int i = 1; i < num_used; i++) {
+        struct stripe_io *io = &ios[used[i]];
+        io->threaded = parallel && pthread_create(&io->thread, NULL, transfer_stripe, io) == 0;
+        if (!io->threaded) {
+            transfer_stripe(io);
+        }
+    }
+    transfer_stripe(&ios[used[0]]);
+
+    int result = 0;
+    for (int i = 0; i < num_used; i++) {
+        if (ios[used[i]].threaded) {
+            pthread_join(ios[used[i]].thread, NULL);
+        }
+        if (ios[used[i]].result != 0) {
+            result = -1;
+        }
+    }
+    free(ios);
+    return result;
+}
+
+/**
+ * @brief Take the least recently used unpinned slot, writing its block back if it changed
+ *
+ * @return int - The slot, now empty and detached from the LRU list
+ */
+static int cache_evict(void) {
+    int slot = lru_tail;
+    while (slots[slot].pinned) {
+        slot = slots[slot].prev;
+    }
+    lru_unlink(slot);
+
+    int block_id = slots[slot].block_id;
+    if (block_id != -1) {
+        if (disk_mode == HEARTYFS_RDWR && hash_block_content(slots[slot].data) != slots[slot].hash) {
+            transfer_run(block_id, &slots[slot].data, 1, 1);
+        }
+        slot_of_block[block_id] = -1;
+        slots[slot].block_id = -1;
+    }
+    return slot;
+}
+
+/**
+ * @brief Load a run of consecutive blocks that are not cached yet in one read
+ *
+ * @param first_block - The first block of the run
+ * @param count - The number of blocks, at most half the cache
+ */
+static void cache_load_run(int first_block, int count) {
+    int run_slots[MIN_CACHE_BLOCKS];
+    char *data[MIN_CACHE_BLOCKS];
+    for (int i = 0; i < count; i++) {
+        run_slots[i] = cache_evict();
+        data[i] = slots[run_slots[i]].data;
+    }
+    if (transfer_run(first_block, data, count, 0) != 0) {
+        for (int i = 0; i < count; i++) {
+            memset(data[i], 0, BLOCK_SIZE);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        int slot = run_slots[i];
+        slots[slot].block_id = first_block + i;
+        slots[slot].hash = hash_block_content(slots[slot].data);
+        slot_of_block[first_block + i] = slot;
+        lru_push_front(slot);
+    }
+}
+
+/**
+ * @brief Map a window into a slot, unmapping the least recently used unpinned window
+ *
+ * @param window - The window number
+ * @return int - The slot now holding the window
+ */
+static int window_map(int window) {
+    int slot = lru_tail;
+    while (slots[slot].pinned) {
+        slot = slots[slot].prev;
+    }
+    lru_unlink(slot);
+
+    // Dirty pages of a shared mapping stay in the page cache, sync flushes them
+    size_t window_size = (size_t)window_blocks * BLOCK_SIZE;
+    if (slots[slot].block_id != -1) {
+        munmap(slots[slot].data, window_size);
+        slot_of_block[slots[slot].block_id] = -1;
+    }
+
+    int stripe;
+    off_t offset = heartyfs_block_location(window * window_blocks, &stripe);
+    slots[slot].data = mmap(NULL, window_size, window_prot, window_flags, disk_fds[stripe], offset);
+    if (slots[slot].data == MAP_FAILED) {
+        perror("Error: Cannot map a window of the disk file");
+        exit(1);
+    }
+    slots[slot].block_id = window;
+    slot_of_block[window] = slot;
+    lru_push_front(slot);
+    return slot;
+}
+
+/**
+ * @brief Pin the windows holding a range of metadata blocks
+ *
+ * @param first_block - The first block
+ * @param num_blocks - The number of blocks
+ * @param lock - 1 to also lock them in memory
+ */
+static void window_pin(int first_block, int num_blocks, int lock) {
+    for (int window = first_block / window_blocks; window <= (first_block + num_blocks - 1) / window_blocks; window++) {
+        int slot = (slot_of_block[window] != -1) ? slot_of_block[window] : window_map(window);
+        if (!slots[slot].pinned && lock) {
+            mlock(slots[slot].data, (size_t)window_blocks * BLOCK_SIZE);
+        }
+        slots[slot].pinned = 1;
+    }
+}
+
+/**
+ * @brief Set up the window engine and map the metadata region
+ *
+ * @param mode - HEARTYFS_RDONLY or HEARTYFS_RDWR
+ * @return int - 0 if successful, -1 if failed
+ */
+static int window_init(int mode) {
+    if ((stripe_unit * BLOCK_SIZE) % page_size != 0) {
+        fprintf(stderr, "Error: The stripe unit is not page aligned, use HEARTYFS_ENGINE=pread\n");
+        return -1;
+    }
+
+    // A power of two number of pages, never crossing a stripe unit
+    const char *blocks = getenv("HEARTYFS_WINDOW_BLOCKS");
+    int wanted = (blocks != NULL && atoi(blocks) > 0) ? atoi(blocks) : DEFAULT_WINDOW_BLOCKS;
+    window_blocks = page_size / BLOCK_SIZE;
+    while (window_blocks * 2 <= wanted && window_blocks * 2 <= stripe_unit) {
+        window_blocks *= 2;
+    }
+    if (window_blocks > stripe_unit) {
+        window_blocks = stripe_unit;
+    }
+
+    const char *windows = getenv("HEARTYFS_WINDOWS");
+    cache_capacity = (windows != NULL) ? atoi(windows) : DEFAULT_WINDOWS;
+    if (cache_capacity < MIN_WINDOWS) {
+        cache_capacity = MIN_WINDOWS;
+    }
+    int num_windows = NUM_BLOCK / window_blocks;
+    if (cache_capacity > num_windows) {
+        cache_capacity = num_windows;
+    }
+
+    window_prot = (mode == HEARTYFS_RDWR) ? PROT_READ | PROT_WRITE : PROT_READ;
+    window_flags = (mode == HEARTYFS_RDWR) ? MAP_SHARED : MAP_PRIVATE;
+    if (env_flag("HEARTYFS_POPULATE", 0)) {
+        window_flags |= MAP_POPULATE;
+    }
+
+    slots = calloc(cache_capacity, sizeof(struct cache_slot));
+    slot_of_block = malloc(num_windows * sizeof(int));
+    memset(slot_of_block, -1, num_windows * sizeof(int));
+    lru_head = -1;
+    lru_tail = -1;
+    for (int i = 0; i < cache_capacity; i++) {
+        slots[i].block_id = -1;
+        lru_push_front(i);
+    }
+
+    // The superblock, bitmap and block tables stay mapped for the whole run
+    int lock = env_flag("HEARTYFS_MLOCK", 1);
+    window_pin(0, 2, lock);
+    struct heartyfs_info *info = get_info((unsigned char *)slots[slot_of_block[0]].data + BLOCK_SIZE);
+    if (info != NULL && info->ref_table != -1) {
+        window_pin(info->ref_table, info->ref_table_blocks, lock);
+    }
+    if (info != NULL && (info->features & HEARTYFS_FEATURE_CHECKSUM)) {
+        window_pin(info->checksum_table, info->checksum_table_blocks, lock);
+    }
+    if (info != NULL && (info->features & HEARTYFS_FEATURE_GENERATIONS)) {
+        window_pin(info->generation_table, info->generation_table_blocks, lock);
+    }
+    return 0;
+}
+
+/**
+ * @brief Unmap every window of the window engine
+ */
+static void window_unmap_all(void) {
+    for (int i = 0; i < cache_capacity; i++) {
+        if (slots[i].block_id != -1) {
+            munmap(slots[i].data, (size_t)window_blocks * BLOCK_SIZE);
+        }
+    }
+}
+
+/**
+ * @brief Get a pointer to a block. With the pread engine the pointer stays valid
+ * while fewer than HEARTYFS_CACHE_BLOCKS other blocks are touched, with the window
+ * engine while fewer than HEARTYFS_WINDOWS other windows are.
+ *
+ * @param buffer - The buffer returned by heartyfs_mount
+ * @param block_id - The block number
+ * @return void* - The block
+ */
+void *heartyfs_block(void *buffer, int block_id) {
+    if (disk_engine == ENGINE_MMAP) {
+        return (char *)buffer + (size_t)block_id * BLOCK_SIZE;
+    }
+
+    if (disk_engine == ENGINE_WINDOW) {
+        pthread_mutex_lock(&cache_lock);
+        int window = block_id / window_blocks;
+        int slot = slot_of_block[window];
+        if (slot == -1) {
+            slot = window_map(window);
+        } else {
+            lru_unlink(slot);
+            lru_push_front(slot);
+        }
+        char *data = slots[slot].data + (size_t)(block_id % window_blocks) * BLOCK_SIZE;
+        pthread_mutex_unlock(&cache_lock);
+        return data;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    int slot = slot_of_block[block_id];
+    if (slot == -1) {
+        cache_load_run(block_id, 1);
+        slot = slot_of_block[block_id];
+    } else {
+        lru_unlink(slot);
+        lru_push_front(slot);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return slots[slot].data;
+}
+
+/**
+ * @brief Check whether the whole image is mapped at buffer, so block pointers never
+ * move and can be shared between threads
+ *
+ * @return int - 1 for the mmap engine, 0 for the buffer cache and windows
+ */
+int heartyfs_flat_mapping(void) {
+    return disk_engine == ENGINE_MMAP;
+}
+
+/**
+ * @brief Set up the buffer cache of the pread engine
+ *
+ * @return int - 0 if successful, -1 if failed
+ */
+static int cache_init(void) {
+    const char *blocks = getenv("HEARTYFS_CACHE_BLOCKS");
+    cache_capacity = (blocks != NULL) ? atoi(blocks) : DEFAULT_CACHE_BLOCKS;
+    if (cache_capacity < MIN_CACHE_BLOCKS) {
+        cache_capacity = MIN_CACHE_BLOCKS;
+    }
+
+    // O_DIRECT needs sector aligned buffers
+    if (posix_memalign((void **)&arena, page_size, (size_t)cache_capacity * BLOCK_SIZE) != 0) {
+        perror("Error: Cannot allocate the buffer cache");
+        return -1;
+    }
+    slots = calloc(cache_capacity, sizeof(struct cache_slot));
+    slot_of_block = malloc(NUM_BLOCK * sizeof(int));
+    memset(slot_of_block, -1, NUM_BLOCK * sizeof(int));
+    lru_head = -1;
+    lru_tail = -1;
+    for (int i = 0; i < cache_capacity; i++) {
+        slots[i].block_id = -1;
+        slots[i].data = arena + (size_t)i * BLOCK_SIZE;
+        lru_push_front(i);
+    }
+
+    // The superblock and bitmap are used by every operation and held for its whole run
+    cache_load_run(0, 2);
+    slots[slot_of_block[0]].pinned = 1;
+    slots[slot_of_block[1]].pinned = 1;
+    return 0;
+}
+
+static int compare_slots(const void *a, const void *b) {
+    return slots[*(const int *)a].block_id - slots[*(const int *)b].block_id;
+}
+
+/**
+ * @brief Write every changed cached block back, sorted by block and coalesced into
+ * one vectored write per run of consecutive blocks
+ *
+ * @return int - 0 if successful, -1 if failed
+ */
+static int cache_write_back(void) {
+    int *dirty = malloc(cache_capacity * sizeof(int));
+    int num_dirty = 0;
+    for (int i = 0; i < cache_capacity; i++) {
+        if (slots[i].block_id != -1 && hash_block_content(slots[i].data) != slots[i].hash) {
+            dirty[num_dirty++] = i;
+        }
+    }
+    qsort(dirty, num_dirty, sizeof(int), compare_slots);
+
+    char **data = malloc((num_dirty + 1) * sizeof(char *));
+    int result = 0;
+    int i = 0;
+    while (i < num_dirty) {
+        int first_block = slots[dirty[i]].block_id;
+        int length = 0;
+        while (i + length < num_dirty && slots[dirty[i + length]].block_id == first_block + length) {
+            data[length] = slots[dirty[i + length]].data;
+            length++;
+        }
+        if (transfer_run(first_block, data, length, 1) != 0) {
+            result = -1;
+        }
+        for (int j = 0; j < length; j++) {
+            slots[dirty[i + j]].hash = hash_block_content(slots[dirty[i + j]].data);
+        }
+        i += length;
+    }
+
+    free(data);
+    free(dirty);
+    return result;
+}
+
+/**
+ * @brief Queue freed blocks to be punched out of the backing files on the next sync.
+ * Their content is left as it is until then.
+ *
+ * @param first_block - The first block of the range
+ * @param num_blocks - The number of blocks in the range
+ * @return int - 0 if queued, -1 if discard mode is off
+ */
+int heartyfs_discard_blocks(int first_block, int num_blocks) {
+    if (discard_queue == NULL) {
+        return -1;
+    }
+    for (int block_id = first_block; block_id < first_block + num_blocks; block_id++) {
+        discard_queue[block_id / 8] |= 1 << (block_id % 8);
+    }
+    return 0;
+}
+
+/**
+ * @brief Clear freed blocks: queue them to be punched in discard mode, zero them otherwise
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param first_block - The first block of the range
+ * @param num_blocks - The number of blocks in the range
+ */
+void heartyfs_clear_blocks(void *buffer, int first_block, int num_blocks) {
+    if (heartyfs_discard_blocks(first_block, num_blocks) == 0) {
+        return;
+    }
+    for (int block_id = first_block; block_id < first_block + num_blocks; block_id++) {
+        memset(heartyfs_block(buffer, block_id), 0, BLOCK_SIZE);
+    }
+}
+
+/**
+ * @brief Punch a run of free blocks out of one backing file, zeroing them instead if
+ * the host file system cannot punch holes. Cached copies are dropped without being
+ * written back.
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param first_block - The first block of the run, all in one stripe unit
+ * @param num_blocks - The number of blocks in the run
+ * @return int - 0 if punched, -1 if zeroed instead
+ */
+static int discard_run(void *buffer, int first_block, int num_blocks) {
+    int stripe;
+    off_t offset = heartyfs_block_location(first_block, &stripe);
+    if (fallocate(disk_fds[stripe], FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, (off_t)num_blocks * BLOCK_SIZE) != 0) {
+        for (int block_id = first_block; block_id < first_block + num_blocks; block_id++) {
+            memset(heartyfs_block(buffer, block_id), 0, BLOCK_SIZE);
+        }
+        return -1;
+    }
+    if (disk_engine == ENGINE_PREAD) {
+        pthread_mutex_lock(&cache_lock);
+        for (int block_id = first_block; block_id < first_block + num_blocks; block_id++) {
+            int slot = slot_of_block[block_id];
+            if (slot != -1 && !slots[slot].pinned) {
+                slots[slot].block_id = -1;
+                slot_of_block[block_id] = -1;
+            }
+        }
+        pthread_mutex_unlock(&cache_lock);
+    }
+    return 0;
+}
+
+/**
+ * @brief Punch every queued block that is still free, coalesced into runs that end at
+ * stripe unit boundaries. Blocks allocated again since they were freed are skipped.
+ *
+ * @param buffer - The buffer containing the disk image
+ */
+static void discard_flush(void *buffer) {
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
+    int unsupported = 0;
+    int block_id = 2;
+    while (block_id < NUM_BLOCK) {
+        int length = 0;
+        while (block_id + length < NUM_BLOCK
+               && (discard_queue[(block_id + length) / 8] & (1 << ((block_id + length) % 8)))
+               && (bitmap[(block_id + length) / 8] & (1 << (7 - (block_id + length) % 8)))
+               && (length == 0 || (block_id + length) % stripe_unit != 0)) {
+            length++;
+        }
+        if (length == 0) {
+            block_id++;
+            continue;
+        }
+        if (discard_run(buffer, block_id, length) != 0) {
+            unsupported = 1;
+        }
+        block_id += length;
+    }
+    if (unsupported) {
+        fprintf(stderr, "Warning: The backing file cannot punch holes, freed blocks were zeroed\n");
+    }
+    memset(discard_queue, 0, NUM_BLOCK / 8);
+}
+
+/**
+ * @brief Size the backing files to hold exactly the first blocks of the image. Space
+ * added reads as zeros and takes no host space until it is written.
+ *
+ * @param num_blocks - The number of blocks the image holds, at most NUM_BLOCK
+ * @return int - 0 if successful, -1 if failed
+ */
+int heartyfs_resize_backing(int num_blocks) {
+    off_t lengths[HEARTYFS_MAX_STRIPES] = { 0 };
+    for (int first = 0; first < num_blocks; first += stripe_unit) {
+        int last = (first + stripe_unit < num_blocks) ? first + stripe_unit - 1 : num_blocks - 1;
+        int stripe;
+        off_t end = heartyfs_block_location(last, &stripe) + BLOCK_SIZE;
+        if (end > lengths[stripe]) {
+            lengths[stripe] = end;
+        }
+    }
+    for (int i = 0; i < num_stripes; i++) {
+        if (ftruncate(disk_fds[i], lengths[i]) == -1) {
+            perror("Error: Cannot resize the backing file");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the space the backing files take on the host, which is less than the
+ * image size when blocks were punched or never written
+ *
+ * @return long long - The allocated bytes over all backing files
+ */
+long long heartyfs_host_usage(void) {
+    long long bytes = 0;
+    for (int i = 0; i < num_stripes; i++) {
+        struct stat st;
+        if (fstat(disk_fds[i], &st) == 0) {
+            bytes += (long long)st.st_blocks * 512;
+        }
+    }
+    return bytes;
+}
+
+/**
+ * @brief Map a striped image onto one contiguous range, one stripe unit at a time
+ *
+ * @param prot - The protection of the mapping
+ * @param flags - The flags of the mapping
+ * @return void* - The buffer containing the disk image, MAP_FAILED if failed
+ */
+static void *map_stripes(int prot, int flags) {
+    if ((stripe_unit * BLOCK_SIZE) % page_size != 0) {
+        fprintf(stderr, "Error: The stripe unit is not page aligned, use HEARTYFS_ENGINE=pread\n");
+        return MAP_FAILED;
+    }
+    char *buffer = mmap(NULL, DISK_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    for (int block_id = 0; block_id < NUM_BLOCK; block_id += stripe_unit) {
+        int stripe;
+        off_t offset = heartyfs_block_location(block_id, &stripe);
+        void *unit = mmap(buffer + (size_t)block_id * BLOCK_SIZE, (size_t)stripe_unit * BLOCK_SIZE,
+                          prot, flags | MAP_FIXED, disk_fds[stripe], offset);
+        if (unit == MAP_FAILED) {
+            munmap(buffer, DISK_SIZE);
+            return MAP_FAILED;
+        }
+    }
+    return buffer;
+}
+
+/**
+ * @brief Open the disk file and set up the engine
+ *
+ * @param mode - HEARTYFS_RDONLY or HEARTYFS_RDWR
+ * @return void* - The buffer containing the disk image, NULL if failed
+ */
+static void *mount_image(int mode) {
+    disk_mode = mode;
+    page_size = sysconf(_SC_PAGESIZE);
+
+    const char *engine = getenv("HEARTYFS_ENGINE");
+    int use_direct = 0;
+    disk_engine = ENGINE_MMAP;
+    if (engine != NULL && strcmp(engine, "mmap") == 0) {
+        disk_engine = ENGINE_MMAP;
+    } else if (engine != NULL && strcmp(engine, "window") == 0) {
+        disk_engine = ENGINE_WINDOW;
+    } else if (engine != NULL && strcmp(engine, "pread") == 0) {
+        disk_engine = ENGINE_PREAD;
+    } else if (engine != NULL && strcmp(engine, "direct") == 0) {
+        disk_engine = ENGINE_PREAD;
+        use_direct = 1;
+    } else if (engine != NULL) {
+        fprintf(stderr, "Error: Unknown HEARTYFS_ENGINE %s\n", engine);
+        return NULL;
+    }
+
+    int open_flags = (mode == HEARTYFS_RDWR) ? O_RDWR : O_RDONLY;
+    if (open_backing_files(open_flags, use_direct) != 0) {
+        return NULL;
+    }
+    if (mode == HEARTYFS_RDWR && env_flag("HEARTYFS_DISCARD", 0)) {
+        discard_queue = calloc(NUM_BLOCK / 8, 1);
+    }
+
+    if (disk_engine == ENGINE_PREAD) {
+        if (cache_init() != 0) {
+            close_backing_files();
+            return NULL;
+        }
+        return &cache_handle;
+    }
+
+    if (disk_engine == ENGINE_WINDOW) {
+        if (window_init(mode) != 0) {
+            close_backing_files();
+            return NULL;
+        }
+        return &cache_handle;
+    }
+
+    int prot = (mode == HEARTYFS_RDWR) ? PROT_READ | PROT_WRITE : PROT_READ;
+    int flags = (mode == HEARTYFS_RDWR) ? MAP_SHARED : MAP_PRIVATE;
+    if (env_flag("HEARTYFS_POPULATE", 0)) {
+        flags |= MAP_POPULATE;
+    }
+
+    void *buffer = (num_stripes == 1) ? mmap(NULL, DISK_SIZE, prot, flags, disk_fds[0], 0) : map_stripes(prot, flags);
+    if (buffer == MAP_FAILED) {
+        perror("Error: Cannot map the disk file onto memory");
+        close_backing_files();
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (env_flag("HEARTYFS_HUGEPAGE", 0)) {
+        madvise(buffer, DISK_SIZE, MADV_HUGEPAGE);
+    }
+#endif
+    if (env_flag("HEARTYFS_MLOCK", 1)) {
+        lock_metadata(buffer);
+    }
+    return buffer;
+}
+
+/**
+ * @brief Open the disk file and map it onto memory
+ *
+ * @param mode - HEARTYFS_RDONLY or HEARTYFS_RDWR
+ * @return void* - The buffer containing the disk image, NULL if failed
+ */
+void *heartyfs_mount(int mode) {
+    heartyfs_phase_begin(HEARTYFS_PHASE_MOUNT);
+    void *buffer = mount_image(mode);
+    heartyfs_phase_end();
+    return buffer;
+}
+
+/**
+ * @brief Flush the changes made to the image to the disk file
+ *
+ * @param buffer - The buffer containing the disk image
+ * @return int - 0 if successful, -1 if failed
+ */
+int heartyfs_sync(void *buffer) {
+    if (disk_mode != HEARTYFS_RDWR) {
+        return 0;
+    }
+    heartyfs_phase_begin(HEARTYFS_PHASE_SYNC);
+    int result = 0;
+
+    // Punch before writing back, so the freed blocks are never written
+    if (discard_queue != NULL) {
+        discard_flush(buffer);
+    }
+    if (disk_engine != ENGINE_MMAP) {
+        // Windows unmapped earlier left their dirty pages in the page cache, so the
+        // backing files are synced as a whole rather than window by window
+        if (disk_engine == ENGINE_PREAD) {
+            pthread_mutex_lock(&cache_lock);
+            result = cache_write_back();
+            pthread_mutex_unlock(&cache_lock);
+        }
+        for (int i = 0; i < num_stripes; i++) {
+            if (fdatasync(disk_fds[i]) == -1) {
+                result = -1;
+            }
+        }
+    } else {
+        result = msync(buffer, DISK_SIZE, MS_SYNC);
+    }
+    heartyfs_phase_end();
+    if (result != 0) {
+        perror("Error: Failed to sync changes to disk");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Unmap the image and close the disk file. Changes are not synced, call
+ * heartyfs_sync first.
+ *
+ * @param buffer - The buffer containing the disk image
+ */
+void heartyfs_unmount(void *buffer) {
+    if (disk_engine == ENGINE_PREAD) {
+        free(arena);
+        free(slots);
+        free(slot_of_block);
+        arena = NULL;
+        slots = NULL;
+        slot_of_block = NULL;
+    } else if (disk_engine == ENGINE_WINDOW) {
+        window_unmap_all();
+        free(slots);
+        free(slot_of_block);
+        slots = NULL;
+        slot_of_block = NULL;
+    } else if (munmap(buffer, DISK_SIZE) == -1) {
+        perror("Error: Failed to unmap file");
+    }
+    free(discard_queue);
+    discard_queue = NULL;
+    close_backing_files();
+}
+
+/**
+ * @brief Tell the block layer a list of blocks is about to be read in order.
+ * The mmap engine asks the kernel to read them ahead, the pread engine loads each
+ * contiguous run that is not cached yet with one vectored read (up to half the cache)
+ * and the window engine starts readahead on the backing files without mapping anything yet.
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param blocks - The blocks, runs of consecutive blocks are read together
+ * @param num_blocks - The number of blocks
+ */
+void heartyfs_prefetch_blocks(void *buffer, const int *blocks, int num_blocks) {
+    if (disk_engine == ENGINE_PREAD) {
+        pthread_mutex_lock(&cache_lock);
+        int loaded = 0;
+        for (int i = 0; i < num_blocks && loaded < cache_capacity / 2; i++) {
+            int length = 0;
+            while (i + length < num_blocks && blocks[i + length] == blocks[i] + length
+                   && slot_of_block[blocks[i] + length] == -1 && loaded + length < cache_capacity / 2
+                   && length < MIN_CACHE_BLOCKS / 2) {
+                length++;
+            }
+            if (length > 0) {
+                cache_load_run(blocks[i], length);
+                loaded += length;
+                i += length - 1;
+            }
+        }
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    if (disk_engine == ENGINE_WINDOW) {
+        for (int i = 0; i < num_blocks; i++) {
+            int length = 1;
+            while (i + length < num_blocks && blocks[i + length] == blocks[i] + length
+                   && (blocks[i] + length) % stripe_unit != 0) {
+                length++;
+            }
+            int stripe;
+            off_t offset = heartyfs_block_location(blocks[i], &stripe);
+            readahead(disk_fds[stripe], offset, (size_t)length * BLOCK_SIZE);
+            i += length - 1;
+        }
+        return;
+    }
+
+    // Advise each contiguous run once
+    int i = 0;
+    while (i < num_blocks) {
+        int length = 1;
+        while (i + length < num_blocks && blocks[i + length] == blocks[i] + length) {
+            length++;
+        }
+        apply_to_blocks(buffer, blocks[i], length, MADV_SEQUENTIAL);
+        apply_to_blocks(buffer, blocks[i], length, MADV_WILLNEED);
+        i += length;
+    }
+}
+
+/**
+ * @brief Tell the block layer the data blocks of a file are about to be read in order
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param inode - The inode of the file about to be read
+ */
+void heartyfs_prefetch_file(void *buffer, struct heartyfs_inode *inode) {
+    int blocks[INODE_BLOCKS];
+    int num_blocks = 0;
+    for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+        if (inode->data_blocks[i] != HOLE_BLOCK) {
+            blocks[num_blocks++] = data_block_of(inode->data_blocks[i]);
+        }
+    }
+    heartyfs_prefetch_blocks(buffer, blocks, num_blocks);
+}
@@ -0,0 +1,148 @@
+/**
+ * @file heartyfs_du.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file reports the block and byte usage of every directory of a subtree in
+ * the heartyfs file system, walking the tree with the parallel walker.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Usage of one directory or inode block. Every block is visited by exactly one
+// thread, so the walker threads fill these without locking.
+struct du_usage {
+    int parent;         // Block of the parent directory
+    int depth;
+    int is_dir;
+    int blocks;         // The block itself plus its data blocks, then everything below it
+    long bytes;         // File size, then the size of everything below it
+    char *path;         // Directories only
+};
+
+static struct du_usage usage[NUM_BLOCK];
+
+/**
+ * @brief Record the usage of one entry
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param entry - The entry being visited
+ * @param state - The block_list of entries visited by this thread
+ */
+void du_visit(void *buffer, const struct heartyfs_walk_entry *entry, void *state) {
+    struct du_usage *own = &usage[entry->block_id];
+    own->parent = entry->parent_block_id;
+    own->depth = entry->depth;
+    own->blocks = 1;
+    own->bytes = 0;
+    own->is_dir = (entry->info == ENTRY_INFO_DIRECTORY);
+    if (own->is_dir) {
+        own->path = strdup(entry->path);
+    } else {
+        // Shared (deduplicated or cloned) data blocks are counted in every file using them,
+        // tails packed into fragment blocks take no block of their own
+        struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, entry->block_id);
+        for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+            if (inode->data_blocks[i] != HOLE_BLOCK && !IS_FRAGMENT(inode->data_blocks[i])) {
+                own->blocks++;
+            }
+        }
+        own->bytes = inode->size;
+    }
+    block_list_add(state, entry->block_id);
+}
+
+static int compare_depth(const void *a, const void *b) {
+    return usage[*(const int *)b].depth - usage[*(const int *)a].depth;
+}
+
+static int compare_path(const void *a, const void *b) {
+    return strcmp(usage[*(const int *)a].path, usage[*(const int *)b].path);
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    int num_threads = 4;
+    int summary = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "sj:")) != -1) {
+        if (opt == 's') {
+            summary = 1;
+        } else if (opt == 'j' && atoi(optarg) > 0) {
+            num_threads = atoi(optarg);
+        } else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-s] [-j threads] <directory_path>\n", argv[0]);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDONLY);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    struct heartyfs_block_list *visited = calloc(num_threads, sizeof(struct heartyfs_block_list));
+    void **states = malloc(num_threads * sizeof(void *));
+    for (int t = 0; t < num_threads; t++) {
+        states[t] = &visited[t];
+    }
+    if (heartyfs_walk(buffer, argv[optind], num_threads, du_visit, states) == -1) {
+        heartyfs_unmount(buffer);
+        return 1;
+    }
+
+    struct heartyfs_block_list all = {0};
+    for (int t = 0; t < num_threads; t++) {
+        for (int i = 0; i < visited[t].count; i++) {
+            block_list_add(&all, visited[t].blocks[i]);
+        }
+        free(visited[t].blocks);
+    }
+
+    // Add every entry into its parent, deepest first, so each directory holds its subtree
+    qsort(all.blocks, all.count, sizeof(int), compare_depth);
+    int num_dirs = 0;
+    for (int i = 0; i < all.count; i++) {
+        struct du_usage *own = &usage[all.blocks[i]];
+        if (own->depth > 0) {
+            usage[own->parent].blocks += own->blocks;
+            usage[own->parent].bytes += own->bytes;
+        }
+        if (own->is_dir) {
+            all.blocks[num_dirs++] = all.blocks[i];
+        }
+    }
+
+    // Directories are visited deepest first, so the walk root is last
+    if (summary) {
+        struct du_usage *root = &usage[all.blocks[num_dirs - 1]];
+        printf("%d\t%ld\t%s\n", root->blocks, root->bytes, root->path);
+    } else {
+        qsort(all.blocks, num_dirs, sizeof(int), compare_path);
+        for (int i = 0; i < num_dirs; i++) {
+            struct du_usage *dir = &usage[all.blocks[i]];
+            printf("%d\t%ld\t%s\n", dir->blocks, dir->bytes, dir->path);
+        }
+    }
+    for (int i = 0; i < num_dirs; i++) {
+        free(usage[all.blocks[i]].path);
+    }
+    free(all.blocks);
+    free(visited);
+    free(states);
+
+    heartyfs_unmount(buffer);
+
+    return 0;
+}
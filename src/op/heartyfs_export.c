@@ -0,0 +1,387 @@
+/**
+ * @file heartyfs_export.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file streams a directory subtree of the heartyfs file system to stdout
+ * as a tar (ustar) archive. Directories come first, then files in the physical order
+ * of their data blocks, so the image is read front to back instead of in directory
+ * order, and the archive is written in large sequential chunks.
+ *
+ * With -i an incremental archive holds only what changed after a generation. Every
+ * change stamps the inode or directory and all directories above it, so the walk only
+ * descends into directories stamped later than that generation. Each of them is
+ * written as a GNU dumpdir entry listing all of its names, which is how
+ * `tar --incremental -x` learns about deletions: names missing from the listing are
+ * removed on extraction.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define TAR_RECORD_SIZE 10240   // Archives are padded to whole 20-block records
+
+// One entry of the export plan
+struct export_entry {
+    int block_id;
+    int is_dir;
+    int first_block;    // Where the entry's data starts on the image, the plan's sort key
+    char *listing;      // Dumpdir of a changed directory in an incremental archive, NULL otherwise
+    int listing_length;
+    char path[HEARTYFS_PATH_MAX];
+};
+
+// The entries collected by the walk
+struct export_plan {
+    struct export_entry *entries;
+    int count;
+    int capacity;
+    size_t root_length;     // Length of the exported directory's path, stripped from archive names
+};
+
+static long archive_time;
+static int gnu_format = 0;      // Incremental archives use GNU headers, tar only reads dumpdirs from those
+
+/**
+ * @brief Append a ustar header
+ *
+ * @param name - The archive name of the entry (directories end with '/')
+ * @param size - The size of the file or dumpdir, 0 for directories
+ * @param type - '0' for a regular file, '5' for a directory, 'D' for a GNU dumpdir,
+ * 'L' for a GNU long name
+ * @return int - 0 if successful, -1 if failed or the name does not fit
+ */
+int emit_tar_header(const char *name, int size, char type) {
+    char header[BLOCK_SIZE];
+    memset(header, 0, sizeof(header));
+
+    // Names longer than 100 bytes are split into prefix/name at a '/'. GNU headers have
+    // no prefix field, so there the whole name goes in a ././@LongLink entry before it.
+    size_t length = strlen(name);
+    if (length <= 100) {
+        memcpy(header, name, length);
+    } else if (gnu_format) {
+        if (emit_tar_header("././@LongLink", length + 1, 'L') != 0 || heartyfs_emit(name, length + 1) != 0
+            || heartyfs_emit(NULL, (BLOCK_SIZE - (length + 1) % BLOCK_SIZE) % BLOCK_SIZE) != 0) {
+            return -1;
+        }
+        memcpy(header, name, 100);
+    } else {
+        const char *split = name + length - 101;
+        while (*split != '\0' && (*split != '/' || split - name > 155)) {
+            split++;
+        }
+        if (*split == '\0' || split == name) {
+            fprintf(stderr, "Error: %s is too long for a tar header, skipped\n", name);
+            return -1;
+        }
+        memcpy(header + 345, name, split - name);
+        memcpy(header, split + 1, length - (split - name) - 1);
+    }
+
+    snprintf(header + 100, 8, "%07o", (type == '0') ? 0644 : 0755);
+    snprintf(header + 108, 8, "%07o", 0);
+    snprintf(header + 116, 8, "%07o", 0);
+    snprintf(header + 124, 12, "%011o", size);
+    snprintf(header + 136, 12, "%011lo", archive_time);
+    header[156] = type;
+    if (gnu_format) {
+        memcpy(header + 257, "ustar  ", 8);
+    } else {
+        memcpy(header + 257, "ustar", 6);
+        memcpy(header + 263, "00", 2);
+    }
+    snprintf(header + 265, 32, "heartyfs");
+    snprintf(header + 297, 32, "heartyfs");
+
+    // The checksum is computed with its own field set to spaces
+    memset(header + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        checksum += (unsigned char)header[i];
+    }
+    snprintf(header + 148, 8, "%06o", checksum);
+    header[155] = ' ';
+    return heartyfs_emit(header, sizeof(header));
+}
+
+/**
+ * @brief Append a file's content and pad it to a whole tar block.
+ * Holes and short blocks are written as zeros, like heartyfs_read.
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param inode - The inode of the file
+ * @return int - 0 if successful, -1 if failed
+ */
+int emit_file_data(void *buffer, struct heartyfs_inode *inode) {
+    heartyfs_prefetch_file(buffer, inode);
+    int remaining = inode->size;
+    for (int i = 0; remaining > 0; i++) {
+        int chunk = (remaining > DATA_BLOCK_NAME_SIZE) ? DATA_BLOCK_NAME_SIZE : remaining;
+        int block_id = (i < INODE_BLOCKS) ? inode->data_blocks[i] : -1;
+        int to_copy = 0;
+        if (block_id != -1 && block_id != HOLE_BLOCK) {
+            const char *data = data_entry_bytes(buffer, block_id, &to_copy);
+            to_copy = (chunk > to_copy) ? to_copy : chunk;
+            if (heartyfs_emit(data, to_copy) != 0) {
+                return -1;
+            }
+        }
+        if (heartyfs_emit(NULL, chunk - to_copy) != 0) {
+            return -1;
+        }
+        remaining -= chunk;
+    }
+    return heartyfs_emit(NULL, (BLOCK_SIZE - inode->size % BLOCK_SIZE) % BLOCK_SIZE);
+}
+
+/**
+ * @brief Append an entry to the export plan
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param plan - The export plan
+ * @param block_id - The directory or inode
+ * @param is_dir - 1 for a directory
+ * @param path - The archive name of the entry
+ * @return struct export_entry* - The planned entry
+ */
+struct export_entry *plan_entry(void *buffer, struct export_plan *plan, int block_id, int is_dir, const char *path) {
+    if (plan->count == plan->capacity) {
+        plan->capacity = (plan->capacity == 0) ? 64 : plan->capacity * 2;
+        plan->entries = realloc(plan->entries, plan->capacity * sizeof(struct export_entry));
+    }
+    struct export_entry *planned = &plan->entries[plan->count++];
+    planned->block_id = block_id;
+    planned->is_dir = is_dir;
+    planned->first_block = block_id;
+    planned->listing = NULL;
+    planned->listing_length = 0;
+    if (!is_dir) {
+        struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, block_id);
+        for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+            if (inode->data_blocks[i] != HOLE_BLOCK) {
+                planned->first_block = data_block_of(inode->data_blocks[i]);
+                break;
+            }
+        }
+    }
+    snprintf(planned->path, sizeof(planned->path), "%s", path);
+    return planned;
+}
+
+/**
+ * @brief Add a walked entry to the export plan
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param entry - The entry being visited
+ * @param state - The export_plan
+ */
+void plan_visit(void *buffer, const struct heartyfs_walk_entry *entry, void *state) {
+    struct export_plan *plan = state;
+    if (entry->depth == 0) {
+        return;  // The exported directory itself is the archive root
+    }
+    plan_entry(buffer, plan, entry->block_id, entry->info == ENTRY_INFO_DIRECTORY, entry->path + plan->root_length);
+}
+
+/**
+ * @brief Plan the changes below a directory stamped after a generation: its dumpdir,
+ * the files stamped after the generation and, recursively, such subdirectories.
+ * A subdirectory moved after the generation is at a new path, so all of it is planned.
+ * Untouched subtrees are only named in the dumpdir and never read.
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param plan - The export plan
+ * @param dir_block_id - The changed directory
+ * @param path - Its archive name, "." for the archive root
+ * @param since - The generation of the previous export, -1 for everything
+ */
+void plan_changes(void *buffer, struct export_plan *plan, int dir_block_id, const char *path, long long since) {
+    // Copy the entries out, the recursion may evict the directory from the block cache
+    struct heartyfs_directory dir;
+    memcpy(&dir, heartyfs_block(buffer, dir_block_id), sizeof(dir));
+    int is_dir[DIR_MAX_ENTRIES];
+    int changed[DIR_MAX_ENTRIES];
+
+    // tar looks names up in a dumpdir by binary search, so it lists them sorted
+    int order[DIR_MAX_ENTRIES];
+    int count = 0;
+    for (int i = 2; i < dir.size; i++) {
+        int at = count++;
+        while (at > 0 && strcmp(dir.entries[order[at - 1]].file_name, dir.entries[i].file_name) > 0) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = i;
+    }
+
+    // Every name with its GNU dumpdir prefix: D directory, Y file in this archive, N file kept
+    char *listing = malloc(DIR_MAX_ENTRIES * (FILENAME_MAXLEN + 1) + 1);
+    int length = 0;
+    for (int n = 0; n < count; n++) {
+        int i = order[n];
+        int child = dir.entries[i].block_id;
+        is_dir[i] = ((struct heartyfs_directory *)heartyfs_block(buffer, child))->type == 1;
+        changed[i] = *get_block_generation(buffer, child) > since;
+        length += sprintf(listing + length, "%c%s", is_dir[i] ? 'D' : (changed[i] ? 'Y' : 'N'), dir.entries[i].file_name) + 1;
+    }
+    listing[length++] = '\0';
+    struct export_entry *planned = plan_entry(buffer, plan, dir_block_id, 1, path);
+    planned->listing = listing;
+    planned->listing_length = length;
+
+    for (int i = 2; i < dir.size; i++) {
+        if (!changed[i]) {
+            continue;
+        }
+        char child_path[HEARTYFS_PATH_MAX];
+        if (strcmp(path, ".") == 0) {
+            snprintf(child_path, sizeof(child_path), "%s", dir.entries[i].file_name);
+        } else {
+            snprintf(child_path, sizeof(child_path), "%s/%s", path, dir.entries[i].file_name);
+        }
+        if (is_dir[i]) {
+            int moved = *get_link_generation(buffer, dir.entries[i].block_id) > since;
+            plan_changes(buffer, plan, dir.entries[i].block_id, child_path, moved ? -1 : since);
+        } else {
+            plan_entry(buffer, plan, dir.entries[i].block_id, 0, child_path);
+        }
+    }
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const struct export_entry *x = a;
+    const struct export_entry *y = b;
+    if (x->is_dir != y->is_dir) {
+        return y->is_dir - x->is_dir;   // Directories first, so files always have a parent
+    }
+    if (x->is_dir) {
+        return strcmp(x->path, y->path);
+    }
+    return x->first_block - y->first_block;
+}
+
+/**
+ * @brief Export a directory subtree as a tar archive on stdout
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param path - The directory to export
+ * @param since - Only export what changed after this generation, -1 for everything
+ * @return int - 0 if successful, -1 if failed
+ */
+int export_tree(void *buffer, const char *path, long long since) {
+    struct export_plan plan = {0};
+    plan.root_length = (strcmp(path, "/") == 0) ? 1 : strlen(path) + 1;
+    while (plan.root_length > 2 && path[plan.root_length - 2] == '/') {
+        plan.root_length--;
+    }
+    struct heartyfs_info *info = get_info((unsigned char *)heartyfs_block(buffer, 1));
+    if (since == -1) {
+        void *state = &plan;
+        if (heartyfs_walk(buffer, path, 1, plan_visit, &state) == -1) {
+            return -1;
+        }
+    } else {
+        struct heartyfs_directory *root;
+        if (info == NULL || !(info->features & HEARTYFS_FEATURE_GENERATIONS)) {
+            fprintf(stderr, "Error: The image has no change generations, see heartyfs_init -g\n");
+            return -1;
+        }
+        int root_block_id = find_directory_by_path(buffer, path, &root);
+        if (root_block_id == -1) {
+            fprintf(stderr, "Error: Directory %s does not exist\n", path);
+            return -1;
+        }
+        gnu_format = 1;
+        if (*get_block_generation(buffer, root_block_id) > since) {
+            plan_changes(buffer, &plan, root_block_id, ".", since);
+        }
+    }
+    qsort(plan.entries, plan.count, sizeof(struct export_entry), compare_entries);
+
+    archive_time = (long)time(NULL);
+    int result = heartyfs_output_open();
+    int dirs = 0;
+    int files = 0;
+    for (int i = 0; i < plan.count && result == 0; i++) {
+        struct export_entry *entry = &plan.entries[i];
+        if (entry->is_dir) {
+            char name[HEARTYFS_PATH_MAX + 1];
+            snprintf(name, sizeof(name), "%s/", entry->path);
+            if (entry->listing != NULL && emit_tar_header(name, entry->listing_length, 'D') == 0) {
+                result = heartyfs_emit(entry->listing, entry->listing_length);
+                if (result == 0) {
+                    result = heartyfs_emit(NULL, (BLOCK_SIZE - entry->listing_length % BLOCK_SIZE) % BLOCK_SIZE);
+                }
+                dirs++;
+            } else if (entry->listing == NULL && emit_tar_header(name, 0, '5') == 0) {
+                dirs++;
+            }
+            free(entry->listing);
+            continue;
+        }
+        struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, entry->block_id);
+        if (emit_tar_header(entry->path, inode->size, '0') == 0) {
+            inode = (struct heartyfs_inode *)heartyfs_block(buffer, entry->block_id);
+            result = emit_file_data(buffer, inode);
+            files++;
+        }
+    }
+
+    // Two zero blocks end the archive, then pad to a whole record
+    if (result == 0) {
+        result = heartyfs_emit(NULL, 2 * BLOCK_SIZE);
+    }
+    if (result == 0) {
+        result = heartyfs_emit(NULL, (TAR_RECORD_SIZE - heartyfs_output_total() % TAR_RECORD_SIZE) % TAR_RECORD_SIZE);
+    }
+    if (result == 0) {
+        result = heartyfs_flush_output();
+    }
+    if (result == 0) {
+        fprintf(stderr, "Exported %d directories and %d files\n", dirs, files);
+        if (info != NULL && (info->features & HEARTYFS_FEATURE_GENERATIONS)) {
+            fprintf(stderr, "Generation: %u\n", info->generation);
+        }
+        heartyfs_trace_bytes(heartyfs_output_total());
+    }
+    heartyfs_output_close();
+    free(plan.entries);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    long long since = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:")) != -1) {
+        if (opt == 'i' && atoll(optarg) >= 0) {
+            since = atoll(optarg);
+        } else {
+            optind = argc + 2;
+            break;
+        }
+    }
+    if (optind + 1 < argc || optind > argc) {
+        fprintf(stderr, "Usage: %s [-i generation] [directory_path] > archive.tar\n", argv[0]);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDONLY);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    int result = export_tree(buffer, (optind < argc) ? argv[optind] : "/", since);
+
+    heartyfs_unmount(buffer);
+
+    return (result == 0) ? 0 : 1;
+}
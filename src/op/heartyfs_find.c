@@ -0,0 +1,172 @@
+/**
+ * @file heartyfs_find.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file finds files and directories by name, type and size in the heartyfs
+ * file system, walking the tree with the parallel walker.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fnmatch.h>
+
+// The filters, all of them must match
+struct find_filter {
+    const char *name;   // fnmatch pattern on the last path component, NULL for any
+    char type;          // 'f', 'd' or 0 for any
+    char size_op;       // '+' larger than, '-' smaller than, '=' exactly, 0 for any
+    int size;           // Bytes, files only
+};
+
+// The matches of one walker thread
+struct find_state {
+    char **paths;
+    int count;
+    int capacity;
+};
+
+static struct find_filter filter;
+
+/**
+ * @brief Check an entry against the filters and remember it if it matches
+ *
+ * @param buffer - Unused
+ * @param entry - The entry being visited
+ * @param state - The find_state of the visiting thread
+ */
+void find_visit(void *buffer, const struct heartyfs_walk_entry *entry, void *state) {
+    (void)buffer;
+    struct find_state *matches = state;
+    int is_dir = (entry->info == ENTRY_INFO_DIRECTORY);
+    if (entry->depth == 0 && filter.name != NULL) {
+        return;  // The starting directory is only listed when nothing filters by name
+    }
+    if ((filter.type == 'f' && is_dir) || (filter.type == 'd' && !is_dir)) {
+        return;
+    }
+    if (filter.size_op != 0) {
+        if (is_dir) {
+            return;
+        }
+        if ((filter.size_op == '+' && entry->info <= filter.size) || (filter.size_op == '-' && entry->info >= filter.size)
+            || (filter.size_op == '=' && entry->info != filter.size)) {
+            return;
+        }
+    }
+    if (filter.name != NULL) {
+        const char *name = strrchr(entry->path, '/');
+        if (fnmatch(filter.name, name ? name + 1 : entry->path, 0) != 0) {
+            return;
+        }
+    }
+
+    if (matches->count == matches->capacity) {
+        matches->capacity = (matches->capacity == 0) ? 64 : matches->capacity * 2;
+        matches->paths = realloc(matches->paths, matches->capacity * sizeof(char *));
+    }
+    matches->paths[matches->count++] = strdup(entry->path);
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Parse a -size argument: [+|-]bytes
+ *
+ * @param arg - The argument
+ * @return int - 0 if successful, -1 if malformed
+ */
+int parse_size(const char *arg) {
+    filter.size_op = '=';
+    if (arg[0] == '+' || arg[0] == '-') {
+        filter.size_op = arg[0];
+        arg++;
+    }
+    char *end;
+    long size = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || size < 0) {
+        return -1;
+    }
+    filter.size = (int)size;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    int num_threads = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "+j:")) != -1) {
+        if (opt == 'j' && atoi(optarg) > 0) {
+            num_threads = atoi(optarg);
+        } else {
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    // The directory comes first, then find-style filters
+    int usage = (optind >= argc);
+    const char *path = usage ? NULL : argv[optind];
+    for (int i = optind + 1; !usage && i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            usage = 1;
+        } else if (strcmp(argv[i], "-name") == 0) {
+            filter.name = argv[i + 1];
+        } else if (strcmp(argv[i], "-type") == 0 && (strcmp(argv[i + 1], "f") == 0 || strcmp(argv[i + 1], "d") == 0)) {
+            filter.type = argv[i + 1][0];
+        } else if (strcmp(argv[i], "-size") == 0 && parse_size(argv[i + 1]) == 0) {
+            // Parsed
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage) {
+        fprintf(stderr, "Usage: %s [-j threads] <directory_path> [-name pattern] [-type f|d] [-size [+|-]bytes]\n", argv[0]);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDONLY);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    struct find_state *states = calloc(num_threads, sizeof(struct find_state));
+    void **state_ptrs = malloc(num_threads * sizeof(void *));
+    for (int t = 0; t < num_threads; t++) {
+        state_ptrs[t] = &states[t];
+    }
+    int used = heartyfs_walk(buffer, path, num_threads, find_visit, state_ptrs);
+
+    // Merge the matches of every thread and print them in path order
+    struct find_state all = {0};
+    for (int t = 0; t < num_threads; t++) {
+        for (int i = 0; i < states[t].count; i++) {
+            if (all.count == all.capacity) {
+                all.capacity = (all.capacity == 0) ? 64 : all.capacity * 2;
+                all.paths = realloc(all.paths, all.capacity * sizeof(char *));
+            }
+            all.paths[all.count++] = states[t].paths[i];
+        }
+        free(states[t].paths);
+    }
+    qsort(all.paths, all.count, sizeof(char *), compare_paths);
+    for (int i = 0; i < all.count; i++) {
+        printf("%s\n", all.paths[i]);
+        free(all.paths[i]);
+    }
+    free(all.paths);
+    free(states);
+    free(state_ptrs);
+
+    heartyfs_unmount(buffer);
+
+    return (used == -1) ? 1 : 0;
+}
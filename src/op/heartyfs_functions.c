@@ -9,6 +9,7 @@
  * 
  */
 #include "../heartyfs.h"
+#include "heartyfs_functions.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,12 +27,15 @@
  * @return int - The block number of the first free block, -1 if no free block is found
  */
 int find_free_block(unsigned char *bitmap) {
-    for (int i = 2; i < NUM_BLOCK; i++) {
+    heartyfs_phase_begin(HEARTYFS_PHASE_ALLOC);
+    int block_id = -1;
+    for (int i = 2; i < NUM_BLOCK && block_id == -1; i++) {
         if (bitmap[i/8] & (1 << (7 - i%8))) { 
-            return i;
+            block_id = i;
         }   
     }
-    return -1;
+    heartyfs_phase_end();
+    return block_id;
 }
 
 /**
@@ -55,6 +59,28 @@ void set_block_free(unsigned char *bitmap, int block_num) {
     bitmap[block_num/8] |= (1 << (7 - block_num%8));
 }
 
+/**
+ * @brief Set a range of blocks free, whole bytes of the bitmap at a time
+ * 
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param start - The first block of the range
+ * @param count - The number of blocks in the range
+ */
+void set_block_range_free(unsigned char *bitmap, int start, int count) {
+    int end = start + count;
+    int block_num = start;
+    while (block_num < end && block_num % 8 != 0) {
+        set_block_free(bitmap, block_num++);
+    }
+    if (end - block_num >= 8) {
+        memset(bitmap + block_num / 8, 0xFF, (end - block_num) / 8);
+        block_num += (end - block_num) / 8 * 8;
+    }
+    while (block_num < end) {
+        set_block_free(bitmap, block_num++);
+    }
+}
+
 /**
  * @brief Find an inode by its path
  * 
@@ -63,12 +89,12 @@ void set_block_free(unsigned char *bitmap, int block_num) {
  * @param inode - The inode object to be returned
  * @return int - The block number of the inode, -1 if not found
  */
-int find_inode_by_path(void *buffer, const char *path, struct heartyfs_inode **inode) {
+static int lookup_inode_by_path(void *buffer, const char *path, struct heartyfs_inode **inode) {
     char *path_copy = strdup(path);
     char *parent_path = dirname(strdup(path_copy));
     char *file_name = basename(path_copy);
 
-    struct heartyfs_directory *current = buffer;
+    struct heartyfs_directory *current = heartyfs_block(buffer, 0);
     int current_block_id = 0;
 
     char *token = strtok(parent_path, "/");
@@ -77,7 +103,7 @@ int find_inode_by_path(void *buffer, const char *path, struct heartyfs_inode **i
         for (int i = 0; i < current->size; i++) {
             if (strcmp(current->entries[i].file_name, token) == 0) {
                 current_block_id = current->entries[i].block_id;
-                current = (struct heartyfs_directory *)((char *)buffer + current_block_id * BLOCK_SIZE);
+                current = (struct heartyfs_directory *)heartyfs_block(buffer, current_block_id);
                 found = 1;
                 break;
             }
@@ -92,7 +118,7 @@ int find_inode_by_path(void *buffer, const char *path, struct heartyfs_inode **i
 
     for (int i = 0; i < current->size; i++) {
         if (strcmp(current->entries[i].file_name, file_name) == 0) {
-            *inode = (struct heartyfs_inode *)((char *)buffer + current->entries[i].block_id * BLOCK_SIZE);
+            *inode = (struct heartyfs_inode *)heartyfs_block(buffer, current->entries[i].block_id);
             free(path_copy);
             free(parent_path);
             return current->entries[i].block_id;
@@ -104,6 +130,21 @@ int find_inode_by_path(void *buffer, const char *path, struct heartyfs_inode **i
     return -1;
 }
 
+/**
+ * @brief Find an inode by its path, timed as path resolution
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param path - The path of the inode
+ * @param inode - The inode object to be returned
+ * @return int - The block number of the inode, -1 if not found
+ */
+int find_inode_by_path(void *buffer, const char *path, struct heartyfs_inode **inode) {
+    heartyfs_phase_begin(HEARTYFS_PHASE_RESOLVE);
+    int block_id = lookup_inode_by_path(buffer, path, inode);
+    heartyfs_phase_end();
+    return block_id;
+}
+
 /**
  * @brief Find the parent directory and file index by its path
  * 
@@ -113,12 +154,12 @@ int find_inode_by_path(void *buffer, const char *path, struct heartyfs_inode **i
  * @param file_index - The index of the file in the parent directory
  * @return int - The block number of the file, -1 if not found
  */
-int find_parent_directory_and_file_index(void *buffer, const char *path, struct heartyfs_directory **parent_dir, int *file_index) {
+static int lookup_parent_directory_and_file_index(void *buffer, const char *path, struct heartyfs_directory **parent_dir, int *file_index) {
     char *path_copy = strdup(path);
     char *parent_path = dirname(strdup(path_copy));
     char *file_name = basename(path_copy);
 
-    struct heartyfs_directory *current = buffer;
+    struct heartyfs_directory *current = heartyfs_block(buffer, 0);
     int current_block_id = 0;
 
     char *token = strtok(parent_path, "/");
@@ -127,7 +168,7 @@ int find_parent_directory_and_file_index(void *buffer, const char *path, struct
         for (int i = 0; i < current->size; i++) {
             if (strcmp(current->entries[i].file_name, token) == 0) {
                 current_block_id = current->entries[i].block_id;
-                current = (struct heartyfs_directory *)((char *)buffer + current_block_id * BLOCK_SIZE);
+                current = (struct heartyfs_directory *)heartyfs_block(buffer, current_block_id);
                 found = 1;
                 break;
             }
@@ -153,4 +194,1361 @@ int find_parent_directory_and_file_index(void *buffer, const char *path, struct
     free(path_copy);
     free(parent_path);
     return -1;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Find the parent directory and file index by its path, timed as path resolution
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param path - The path of the file
+ * @param parent_dir - The parent directory object to be returned
+ * @param file_index - The index of the file in the parent directory
+ * @return int - The block number of the file, -1 if not found
+ */
+int find_parent_directory_and_file_index(void *buffer, const char *path, struct heartyfs_directory **parent_dir, int *file_index) {
+    heartyfs_phase_begin(HEARTYFS_PHASE_RESOLVE);
+    int block_id = lookup_parent_directory_and_file_index(buffer, path, parent_dir, file_index);
+    heartyfs_phase_end();
+    return block_id;
+}
+/**
+ * @brief Get the info stored in the second half of the bitmap block
+ * 
+ * @param bitmap - The bitmap containing the block allocation information
+ * @return struct heartyfs_info* - The info, NULL if the image predates it
+ */
+struct heartyfs_info *get_info(unsigned char *bitmap) {
+    struct heartyfs_info *info = (struct heartyfs_info *)(bitmap + INFO_OFFSET);
+    return (info->magic == HEARTYFS_MAGIC) ? info : NULL;
+}
+
+/**
+ * @brief Find the first run of contiguous free blocks starting in a range of blocks.
+ * The run may extend past the end of the range.
+ * 
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param from - The first block the run may start at
+ * @param to - The block past the last one the run may start at
+ * @param count - The number of contiguous blocks needed
+ * @return int - The first block of the run, -1 if there is none
+ */
+static int find_free_run_from(unsigned char *bitmap, int from, int to, int count) {
+    int run_length = 0;
+    for (int i = from; i < NUM_BLOCK && (run_length > 0 || i < to); i++) {
+        if (bitmap[i/8] & (1 << (7 - i%8))) {
+            if (++run_length == count) {
+                return i - count + 1;
+            }
+        } else {
+            run_length = 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Find a run of contiguous free blocks close to a goal block, ext2 style:
+ * first after the goal in its block group, then earlier in the group, then in the
+ * following groups in turn, wrapping around the image
+ * 
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param count - The number of contiguous blocks needed
+ * @param goal - The block to place the run near
+ * @return int - The first block of the run, -1 if no run is large enough
+ */
+int find_free_run_near(unsigned char *bitmap, int count, int goal) {
+    if (goal < 2 || goal >= NUM_BLOCK) {
+        goal = 2;
+    }
+    heartyfs_phase_begin(HEARTYFS_PHASE_ALLOC);
+    int group = goal / BLOCKS_PER_GROUP;
+    int group_start = (group * BLOCKS_PER_GROUP > 2) ? group * BLOCKS_PER_GROUP : 2;
+    int run_start = find_free_run_from(bitmap, goal, (group + 1) * BLOCKS_PER_GROUP, count);
+    if (run_start == -1) {
+        run_start = find_free_run_from(bitmap, group_start, goal, count);
+    }
+    for (int i = 1; i < NUM_GROUPS && run_start == -1; i++) {
+        int next = (group + i) % NUM_GROUPS;
+        int next_start = (next * BLOCKS_PER_GROUP > 2) ? next * BLOCKS_PER_GROUP : 2;
+        run_start = find_free_run_from(bitmap, next_start, (next + 1) * BLOCKS_PER_GROUP, count);
+    }
+    heartyfs_phase_end();
+    return run_start;
+}
+
+/**
+ * @brief Find a free block close to a goal block, see find_free_run_near
+ * 
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param goal - The block to place the new block near, such as its directory or inode
+ * @return int - The block number of the free block, -1 if no free block is found
+ */
+int find_free_block_near(unsigned char *bitmap, int goal) {
+    return find_free_run_near(bitmap, 1, goal);
+}
+
+/**
+ * @brief Choose where a new directory goes. Directories created in the root start
+ * in the block group with the most free blocks, so top-level trees spread over the
+ * image and each one grows within its own group. Deeper directories stay near their
+ * parent.
+ * 
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param parent_block_id - The directory receiving the new directory
+ * @return int - The goal block for find_free_block_near
+ */
+int directory_goal(unsigned char *bitmap, int parent_block_id) {
+    if (parent_block_id != 0) {
+        return parent_block_id;
+    }
+    int best_group = 0;
+    int best_free = -1;
+    for (int group = 0; group < NUM_GROUPS; group++) {
+        int free_blocks = 0;
+        for (int i = group * BLOCKS_PER_GROUP; i < (group + 1) * BLOCKS_PER_GROUP; i++) {
+            free_blocks += (i >= 2 && (bitmap[i/8] & (1 << (7 - i%8)))) ? 1 : 0;
+        }
+        if (free_blocks > best_free) {
+            best_group = group;
+            best_free = free_blocks;
+        }
+    }
+    return best_group * BLOCKS_PER_GROUP;
+}
+
+/**
+ * @brief Find the first run of contiguous free blocks in the bitmap
+ * 
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param count - The number of contiguous blocks needed
+ * @return int - The first block of the run, -1 if no run is large enough
+ */
+int find_free_run(unsigned char *bitmap, int count) {
+    heartyfs_phase_begin(HEARTYFS_PHASE_ALLOC);
+    int run_start = find_free_run_from(bitmap, 2, NUM_BLOCK, count);
+    heartyfs_phase_end();
+    return run_start;
+}
+
+/**
+ * @brief Allocate and clear the block reference table
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @return int - 0 if successful, -1 if failed
+ */
+int create_ref_table(void *buffer, unsigned char *bitmap) {
+    struct heartyfs_info *info = get_info(bitmap);
+    if (info == NULL) {
+        fprintf(stderr, "Error: heartyfs info is missing, re-run heartyfs_init\n");
+        return -1;
+    }
+    if (info->ref_table != -1) {
+        return 0;
+    }
+
+    int table_blocks = (NUM_BLOCK + REFS_PER_BLOCK - 1) / REFS_PER_BLOCK;
+    int start = find_free_run(bitmap, table_blocks);
+    if (start == -1) {
+        fprintf(stderr, "Error: No room for the block reference table\n");
+        return -1;
+    }
+
+    for (int i = 0; i < table_blocks; i++) {
+        set_block_used(bitmap, start + i);
+    }
+    for (int i = 0; i < table_blocks; i++) {
+        memset(heartyfs_block(buffer, start + i), 0, BLOCK_SIZE);
+    }
+    info->ref_table = start;
+    info->ref_table_blocks = table_blocks;
+    return 0;
+}
+
+/**
+ * @brief Get the reference table entry of a block
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param block_id - The block number to look up
+ * @return struct heartyfs_block_ref* - The entry, NULL if the image has no reference table
+ */
+struct heartyfs_block_ref *get_block_ref(void *buffer, int block_id) {
+    struct heartyfs_info *info = get_info((unsigned char *)heartyfs_block(buffer, 1));
+    if (info == NULL || info->ref_table == -1) {
+        return NULL;
+    }
+    struct heartyfs_block_ref *table = (struct heartyfs_block_ref *)heartyfs_block(buffer, info->ref_table + block_id / REFS_PER_BLOCK);
+    return &table[block_id % REFS_PER_BLOCK];
+}
+
+/**
+ * @brief Allocate and clear the generation table
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @return int - 0 if successful, -1 if failed
+ */
+int create_generation_table(void *buffer, unsigned char *bitmap) {
+    struct heartyfs_info *info = get_info(bitmap);
+    if (info == NULL) {
+        fprintf(stderr, "Error: heartyfs info is missing, re-run heartyfs_init\n");
+        return -1;
+    }
+    if (info->features & HEARTYFS_FEATURE_GENERATIONS) {
+        return 0;
+    }
+
+    // Change generations of all blocks, then their link generations
+    int table_blocks = 2 * ((NUM_BLOCK + GENERATIONS_PER_BLOCK - 1) / GENERATIONS_PER_BLOCK);
+    int start = find_free_run(bitmap, table_blocks);
+    if (start == -1) {
+        fprintf(stderr, "Error: No room for the generation table\n");
+        return -1;
+    }
+
+    for (int i = 0; i < table_blocks; i++) {
+        set_block_used(bitmap, start + i);
+        memset(heartyfs_block(buffer, start + i), 0, BLOCK_SIZE);
+    }
+    info->generation = 0;
+    info->generation_table = start;
+    info->generation_table_blocks = table_blocks;
+    info->features |= HEARTYFS_FEATURE_GENERATIONS;
+    return 0;
+}
+
+/**
+ * @brief Get the generation table entry of a block
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param block_id - The block number to look up
+ * @return unsigned int* - The entry (0 if never stamped), NULL if the image has no generation table
+ */
+unsigned int *get_block_generation(void *buffer, int block_id) {
+    struct heartyfs_info *info = get_info((unsigned char *)heartyfs_block(buffer, 1));
+    if (info == NULL || !(info->features & HEARTYFS_FEATURE_GENERATIONS)) {
+        return NULL;
+    }
+    unsigned int *table = (unsigned int *)heartyfs_block(buffer, info->generation_table + block_id / GENERATIONS_PER_BLOCK);
+    return &table[block_id % GENERATIONS_PER_BLOCK];
+}
+
+/**
+ * @brief Get the link generation of a directory, the generation it was last moved in.
+ * Everything below a directory moved after a generation is at a new path since.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param block_id - The directory
+ * @return unsigned int* - The entry (0 if never moved), NULL if the image has no generation table
+ */
+unsigned int *get_link_generation(void *buffer, int block_id) {
+    struct heartyfs_info *info = get_info((unsigned char *)heartyfs_block(buffer, 1));
+    if (info == NULL || !(info->features & HEARTYFS_FEATURE_GENERATIONS)) {
+        return NULL;
+    }
+    unsigned int *table = (unsigned int *)heartyfs_block(buffer, info->generation_table + (NUM_BLOCK + block_id) / GENERATIONS_PER_BLOCK);
+    return &table[(NUM_BLOCK + block_id) % GENERATIONS_PER_BLOCK];
+}
+
+/**
+ * @brief Stamp a changed inode or directory and every directory above it with the
+ * generation of this run. The first stamp of a run takes the next generation, so one
+ * tool run is one generation, and a directory's generation is never older than
+ * anything below it.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param block_id - The inode or directory that changed, -1 when only its parent did (removal)
+ * @param parent_block_id - The directory holding it
+ */
+void stamp_generation(void *buffer, int block_id, int parent_block_id) {
+    static unsigned int run_generation = 0;
+    struct heartyfs_info *info = get_info((unsigned char *)heartyfs_block(buffer, 1));
+    if (info == NULL || !(info->features & HEARTYFS_FEATURE_GENERATIONS)) {
+        return;
+    }
+    if (run_generation == 0) {
+        run_generation = ++info->generation;
+    }
+    if (block_id != -1) {
+        *get_block_generation(buffer, block_id) = run_generation;
+    }
+
+    // Walk up through "..", the rest of the path is already stamped once one directory is
+    for (int depth = 0; depth < NUM_BLOCK; depth++) {
+        unsigned int *generation = get_block_generation(buffer, parent_block_id);
+        if (*generation == run_generation) {
+            return;
+        }
+        *generation = run_generation;
+        if (parent_block_id == 0) {
+            return;
+        }
+        parent_block_id = ((struct heartyfs_directory *)heartyfs_block(buffer, parent_block_id))->entries[1].block_id;
+    }
+}
+
+/**
+ * @brief Stamp a directory moved to a new parent. Only the directory records the move,
+ * in its link generation, so a move costs the same for any subtree size.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param dir_block_id - The moved directory
+ * @param parent_block_id - Its new parent
+ */
+void stamp_moved_directory(void *buffer, int dir_block_id, int parent_block_id) {
+    stamp_generation(buffer, dir_block_id, parent_block_id);
+    unsigned int *generation = get_block_generation(buffer, dir_block_id);
+    if (generation != NULL) {
+        unsigned int moved = *generation;
+        *get_link_generation(buffer, dir_block_id) = moved;
+    }
+}
+
+/**
+ * @brief Hash the used part of a data block (FNV-1a), never returns 0
+ * 
+ * @param data_block - The data block to hash
+ * @return unsigned int - The hash value
+ */
+unsigned int hash_data_block(const struct heartyfs_data_block *data_block) {
+    unsigned int hash = 2166136261u;
+    const unsigned char *bytes = (const unsigned char *)data_block;
+    int length = sizeof(data_block->size) + data_block->size;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return (hash == 0) ? 1 : hash;
+}
+
+// In-memory hash -> block index, built from the reference table on first use
+static int *dedup_index = NULL;
+static int dedup_index_mask = 0;
+
+static void dedup_index_insert(unsigned int hash, int block_id) {
+    if (dedup_index == NULL) {
+        return;  // Picked up from the reference table when the index is built
+    }
+    int slot = hash & dedup_index_mask;
+    while (dedup_index[slot] != -1 && dedup_index[slot] != block_id) {
+        slot = (slot + 1) & dedup_index_mask;
+    }
+    dedup_index[slot] = block_id;
+}
+
+static void dedup_index_build(void *buffer) {
+    int size = 1;
+    while (size < 2 * NUM_BLOCK) {
+        size <<= 1;
+    }
+    dedup_index = malloc(size * sizeof(int));
+    memset(dedup_index, -1, size * sizeof(int));
+    dedup_index_mask = size - 1;
+
+    for (int i = 2; i < NUM_BLOCK; i++) {
+        struct heartyfs_block_ref *ref = get_block_ref(buffer, i);
+        if (ref->refs > 0 && ref->hash != 0) {
+            dedup_index_insert(ref->hash, i);
+        }
+    }
+}
+
+/**
+ * @brief Find an existing data block with the same content
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param data_block - The content to look for
+ * @param hash - The hash of the content
+ * @return int - The block number of the identical block, -1 if none
+ */
+static int dedup_find_block(void *buffer, const struct heartyfs_data_block *data_block, unsigned int hash) {
+    if (dedup_index == NULL) {
+        dedup_index_build(buffer);
+    }
+    int length = sizeof(data_block->size) + data_block->size;
+    for (int slot = hash & dedup_index_mask; dedup_index[slot] != -1; slot = (slot + 1) & dedup_index_mask) {
+        int block_id = dedup_index[slot];
+        struct heartyfs_block_ref *ref = get_block_ref(buffer, block_id);
+        // Entries can be stale if the block was freed since, so confirm before sharing
+        if (ref->refs > 0 && ref->hash == hash && memcmp(heartyfs_block(buffer, block_id), data_block, length) == 0) {
+            return block_id;
+        }
+    }
+    return -1;
+}
+
+static int dedup_enabled(unsigned char *bitmap) {
+    struct heartyfs_info *info = get_info(bitmap);
+    return (info != NULL && (info->features & HEARTYFS_FEATURE_DEDUP) && info->ref_table != -1);
+}
+
+/**
+ * @brief Share an existing block with the same content, if dedup is enabled
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param data_block - The content to look for
+ * @return int - The block number now referenced once more, -1 if there is none
+ */
+int share_identical_block(void *buffer, unsigned char *bitmap, const struct heartyfs_data_block *data_block) {
+    if (!dedup_enabled(bitmap)) {
+        return -1;
+    }
+    int block_id = dedup_find_block(buffer, data_block, hash_data_block(data_block));
+    if (block_id != -1) {
+        get_block_ref(buffer, block_id)->refs++;
+    }
+    return block_id;
+}
+
+/**
+ * @brief Write a data block into a free block and mark it used
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param block_id - The free block to write to
+ * @param data_block - The content to store
+ */
+void place_data_block(void *buffer, unsigned char *bitmap, int block_id, const struct heartyfs_data_block *data_block) {
+    set_block_used(bitmap, block_id);
+    memcpy(heartyfs_block(buffer, block_id), data_block, BLOCK_SIZE);
+    record_block_checksum(buffer, block_id);
+
+    struct heartyfs_block_ref *ref = get_block_ref(buffer, block_id);
+    if (ref != NULL) {
+        ref->refs = 1;
+        ref->hash = 0;
+        // Reserved blocks stay with their file, so they are never offered for sharing
+        if (dedup_enabled(bitmap) && !(data_block->size & DATA_BLOCK_RESERVED)) {
+            ref->hash = hash_data_block(data_block);
+            dedup_index_insert(ref->hash, block_id);
+        }
+    }
+}
+
+/**
+ * @brief Store a data block, sharing an identical block when dedup is enabled
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param data_block - The content to store
+ * @param goal - The block to place a new block near, usually the inode
+ * @return int - The block number holding the content, -1 if no free block is found
+ */
+int store_data_block(void *buffer, unsigned char *bitmap, const struct heartyfs_data_block *data_block, int goal) {
+    int block_id = share_identical_block(buffer, bitmap, data_block);
+    if (block_id != -1) {
+        return block_id;
+    }
+
+    block_id = find_free_block_near(bitmap, goal);
+    if (block_id == -1) {
+        return -1;
+    }
+    place_data_block(buffer, bitmap, block_id, data_block);
+    return block_id;
+}
+
+/**
+ * @brief Check whether short tails are packed into fragment blocks
+ * 
+ * @param bitmap - The bitmap containing the block allocation information
+ * @return int - 1 if tail packing is on, 0 otherwise
+ */
+static int fragments_enabled(unsigned char *bitmap) {
+    struct heartyfs_info *info = get_info(bitmap);
+    return (info != NULL && (info->features & HEARTYFS_FEATURE_FRAGMENTS));
+}
+
+/**
+ * @brief Get the block a data_blocks[] entry lives in, the fragment block for a packed tail
+ * 
+ * @param entry - A data_blocks[] value other than -1 and HOLE_BLOCK
+ * @return int - The block number
+ */
+int data_block_of(int entry) {
+    return IS_FRAGMENT(entry) ? FRAGMENT_BLOCK(entry) : entry;
+}
+
+/**
+ * @brief Get the content of a data_blocks[] entry, a whole data block or a packed tail.
+ * The pointer stays valid as long as one returned by heartyfs_block.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param entry - A data_blocks[] value other than -1 and HOLE_BLOCK
+ * @param length - Set to the number of bytes stored, the rest of the chunk reads as zeros
+ * @return const char* - The bytes
+ */
+const char *data_entry_bytes(void *buffer, int entry, int *length) {
+    if (IS_FRAGMENT(entry)) {
+        struct heartyfs_fragment_block *fragment = (struct heartyfs_fragment_block *)heartyfs_block(buffer, FRAGMENT_BLOCK(entry));
+        int unit = FRAGMENT_UNIT_OF(entry);
+        *length = fragment->length[unit];
+        return (const char *)fragment + unit * FRAGMENT_UNIT;
+    }
+    struct heartyfs_data_block *data_block = (struct heartyfs_data_block *)heartyfs_block(buffer, entry);
+    *length = data_block->size & ~DATA_BLOCK_RESERVED;
+    return data_block->name;
+}
+
+/**
+ * @brief Find a run of free units in a fragment block
+ * 
+ * @param fragment - The fragment block
+ * @param count - The number of units needed
+ * @return int - The first unit of the run, -1 if there is none that long
+ */
+static int find_free_units(const struct heartyfs_fragment_block *fragment, int count) {
+    int run = 0;
+    for (int unit = 1; unit < FRAGMENT_UNITS; unit++) {
+        run = (fragment->used & (1 << unit)) ? 0 : run + 1;
+        if (run == count) {
+            return unit - count + 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Count the free units of a fragment block
+ * 
+ * @param fragment - The fragment block
+ * @return int - The number of free units
+ */
+static int count_free_units(const struct heartyfs_fragment_block *fragment) {
+    int count = 0;
+    for (int unit = 1; unit < FRAGMENT_UNITS; unit++) {
+        count += !(fragment->used & (1 << unit));
+    }
+    return count;
+}
+
+/**
+ * @brief Pack a short tail into a fragment block. Tails go into the image's current
+ * fragment block, a new one is started near the goal once it has no room left.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param data - The bytes of the tail
+ * @param length - The number of bytes, at most FRAGMENT_TAIL_MAX
+ * @param goal - The block to start a new fragment block near, usually the inode
+ * @return int - The data_blocks[] entry of the tail, -1 if tail packing is off, the tail
+ * is too long or no block is free
+ */
+int store_fragment(void *buffer, unsigned char *bitmap, const char *data, int length, int goal) {
+    if (!fragments_enabled(bitmap) || length <= 0 || length > FRAGMENT_TAIL_MAX) {
+        return -1;
+    }
+    struct heartyfs_info *info = get_info(bitmap);
+    int units = (length + FRAGMENT_UNIT - 1) / FRAGMENT_UNIT;
+    int block_id = info->fragment_block;
+    int unit = -1;
+    struct heartyfs_fragment_block *fragment = NULL;
+    if (block_id != -1) {
+        fragment = (struct heartyfs_fragment_block *)heartyfs_block(buffer, block_id);
+        unit = find_free_units(fragment, units);
+    }
+    if (unit == -1) {
+        block_id = find_free_block_near(bitmap, goal);
+        if (block_id == -1) {
+            return -1;
+        }
+        set_block_used(bitmap, block_id);
+        fragment = (struct heartyfs_fragment_block *)heartyfs_block(buffer, block_id);
+        memset(fragment, 0, BLOCK_SIZE);
+        fragment->magic = FRAGMENT_MAGIC;
+        fragment->used = 1;
+        info->fragment_block = block_id;
+        unit = 1;
+    }
+
+    char *tail = (char *)fragment + unit * FRAGMENT_UNIT;
+    memset(tail, 0, units * FRAGMENT_UNIT);
+    memcpy(tail, data, length);
+    fragment->used |= ((1 << units) - 1) << unit;
+    fragment->length[unit] = length;
+    record_block_checksum(buffer, block_id);
+    return FRAGMENT_ENTRY(block_id, unit);
+}
+
+/**
+ * @brief Free the units of a packed tail. A fragment block left empty is freed, one
+ * left with more room than the current fragment block becomes the current one.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param entry - The data_blocks[] entry of the tail
+ */
+static void release_fragment(void *buffer, unsigned char *bitmap, int entry) {
+    struct heartyfs_info *info = get_info(bitmap);
+    int block_id = FRAGMENT_BLOCK(entry);
+    int unit = FRAGMENT_UNIT_OF(entry);
+    struct heartyfs_fragment_block *fragment = (struct heartyfs_fragment_block *)heartyfs_block(buffer, block_id);
+    int units = (fragment->length[unit] + FRAGMENT_UNIT - 1) / FRAGMENT_UNIT;
+    memset((char *)fragment + unit * FRAGMENT_UNIT, 0, units * FRAGMENT_UNIT);
+    fragment->used &= ~(((1 << units) - 1) << unit);
+    fragment->length[unit] = 0;
+
+    if (fragment->used == 1) {
+        if (info->fragment_block == block_id) {
+            info->fragment_block = -1;
+        }
+        heartyfs_clear_blocks(buffer, block_id, 1);
+        set_block_free(bitmap, block_id);
+        return;
+    }
+    record_block_checksum(buffer, block_id);
+    int free_units = count_free_units(fragment);
+    if (info->fragment_block == -1 || (info->fragment_block != block_id
+        && free_units > count_free_units((struct heartyfs_fragment_block *)heartyfs_block(buffer, info->fragment_block)))) {
+        info->fragment_block = block_id;
+    }
+}
+
+/**
+ * @brief Drop one reference to a data block without freeing it
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param block_id - The data block losing a reference
+ * @return int - 1 if that was the last reference and the block should be freed, 0 otherwise
+ */
+int drop_block_ref(void *buffer, int block_id) {
+    struct heartyfs_block_ref *ref = get_block_ref(buffer, block_id);
+    if (ref != NULL) {
+        if (ref->refs > 1) {
+            ref->refs--;
+            return 0;
+        }
+        ref->refs = 0;
+        ref->hash = 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Drop one reference to a data block, freeing it when it was the last one
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param block_id - The data block to release, or the data_blocks[] entry of a packed tail
+ */
+void release_data_block(void *buffer, unsigned char *bitmap, int block_id) {
+    if (IS_FRAGMENT(block_id)) {
+        release_fragment(buffer, bitmap, block_id);
+    } else if (drop_block_ref(buffer, block_id)) {
+        heartyfs_clear_blocks(buffer, block_id, 1);
+        set_block_free(bitmap, block_id);
+    }
+}
+
+/**
+ * @brief Release every data block of an inode, skipping holes
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param inode - The inode whose data blocks are released
+ */
+void release_inode_blocks(void *buffer, unsigned char *bitmap, struct heartyfs_inode *inode) {
+    for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+        if (inode->data_blocks[i] != HOLE_BLOCK) {
+            release_data_block(buffer, bitmap, inode->data_blocks[i]);
+        }
+        inode->data_blocks[i] = -1;
+    }
+}
+
+/**
+ * @brief Count the free blocks in the bitmap
+ * 
+ * @param bitmap - The bitmap containing the block allocation information
+ * @return int - The number of free blocks
+ */
+int count_free_blocks(unsigned char *bitmap) {
+    int count = 0;
+    for (int i = 2; i < NUM_BLOCK; i++) {
+        if (bitmap[i/8] & (1 << (7 - i%8))) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Find a directory by its full path
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param path - The path of the directory
+ * @param dir - The directory object to be returned
+ * @return int - The block number of the directory, -1 if not found or not a directory
+ */
+static int lookup_directory_by_path(void *buffer, const char *path, struct heartyfs_directory **dir) {
+    char *path_copy = strdup(path);
+    struct heartyfs_directory *current = heartyfs_block(buffer, 0);
+    int current_block_id = 0;
+
+    char *token = strtok(path_copy, "/");
+    while (token != NULL) {
+        int found = 0;
+        for (int i = 0; i < current->size; i++) {
+            if (strcmp(current->entries[i].file_name, token) == 0) {
+                current_block_id = current->entries[i].block_id;
+                current = (struct heartyfs_directory *)heartyfs_block(buffer, current_block_id);
+                found = 1;
+                break;
+            }
+        }
+        if (!found || current->type != 1) {
+            free(path_copy);
+            return -1;
+        }
+        token = strtok(NULL, "/");
+    }
+
+    *dir = current;
+    free(path_copy);
+    return current_block_id;
+}
+
+/**
+ * @brief Find a directory by its full path, timed as path resolution
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param path - The path of the directory
+ * @param dir - The directory object to be returned
+ * @return int - The block number of the directory, -1 if not found or not a directory
+ */
+int find_directory_by_path(void *buffer, const char *path, struct heartyfs_directory **dir) {
+    heartyfs_phase_begin(HEARTYFS_PHASE_RESOLVE);
+    int block_id = lookup_directory_by_path(buffer, path, dir);
+    heartyfs_phase_end();
+    return block_id;
+}
+
+/**
+ * @brief Get the entry_info value describing a directory or inode block
+ * 
+ * @param entry_block - The directory or inode block
+ * @return unsigned short - ENTRY_INFO_DIRECTORY or the file size
+ */
+unsigned short entry_info_of(void *entry_block) {
+    struct heartyfs_inode *inode = (struct heartyfs_inode *)entry_block;
+    return (inode->type == 1) ? ENTRY_INFO_DIRECTORY : (unsigned short)inode->size;
+}
+
+/**
+ * @brief Add an entry to a directory
+ * 
+ * @param dir - The directory to add the entry to
+ * @param block_id - The block number the entry points at
+ * @param name - The name of the entry
+ * @param info - The type and size of the entry, see entry_info_of
+ * @return int - 0 if successful, -1 if the name exists or the directory is full
+ */
+int add_directory_entry(struct heartyfs_directory *dir, int block_id, const char *name, unsigned short info) {
+    for (int i = 0; i < dir->size; i++) {
+        if (strcmp(dir->entries[i].file_name, name) == 0) {
+            fprintf(stderr, "Error: %s already exists\n", name);
+            return -1;
+        }
+    }
+    if (dir->size >= DIR_MAX_ENTRIES) {
+        fprintf(stderr, "Error: Directory %s is full\n", dir->name);
+        return -1;
+    }
+
+    dir->entries[dir->size].block_id = block_id;
+    memset(dir->entries[dir->size].file_name, 0, FILENAME_MAXLEN);
+    strncpy(dir->entries[dir->size].file_name, name, FILENAME_MAXLEN - 1);
+    dir->entry_info[dir->size] = info;
+    dir->size++;
+    return 0;
+}
+
+/**
+ * @brief Remove an entry from a directory, keeping the remaining entries in order
+ * 
+ * @param dir - The directory to remove the entry from
+ * @param index - The index of the entry
+ */
+void remove_directory_entry(struct heartyfs_directory *dir, int index) {
+    for (int i = index; i < dir->size - 1; i++) {
+        dir->entries[i] = dir->entries[i + 1];
+        dir->entry_info[i] = dir->entry_info[i + 1];
+    }
+    dir->size--;
+}
+
+/**
+ * @brief Add one reference to a data block that another inode already points at
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param block_id - The data block being shared
+ */
+void share_data_block(void *buffer, int block_id) {
+    struct heartyfs_block_ref *ref = get_block_ref(buffer, block_id);
+    // Untracked blocks have exactly one owner so far
+    ref->refs = (ref->refs == 0) ? 2 : ref->refs + 1;
+}
+
+/**
+ * @brief Clone an inode by sharing its data blocks, later writes copy them. Packed
+ * tails are copied right away.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param src_block_id - The block number of the inode to clone
+ * @param name - The name of the clone
+ * @param parent_block_id - The directory receiving the clone, the inode is placed near it
+ * @return int - The block number of the new inode, -1 if failed
+ */
+int clone_inode(void *buffer, unsigned char *bitmap, int src_block_id, const char *name, int parent_block_id) {
+    if (create_ref_table(buffer, bitmap) != 0) {
+        return -1;
+    }
+
+    int block_id = find_free_block_near(bitmap, parent_block_id);
+    if (block_id == -1) {
+        fprintf(stderr, "Error: No free blocks available\n");
+        return -1;
+    }
+    set_block_used(bitmap, block_id);
+
+    struct heartyfs_inode *src = (struct heartyfs_inode *)heartyfs_block(buffer, src_block_id);
+    struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, block_id);
+    memcpy(inode, src, BLOCK_SIZE);
+    memset(inode->name, 0, sizeof(inode->name));
+    strncpy(inode->name, name, sizeof(inode->name) - 1);
+
+    for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+        int entry = inode->data_blocks[i];
+        if (entry == HOLE_BLOCK) {
+            continue;
+        }
+        if (!IS_FRAGMENT(entry)) {
+            share_data_block(buffer, entry);
+            continue;
+        }
+
+        // Packed tails have one owner, the clone gets its own copy
+        struct heartyfs_data_block data_block;
+        memset(&data_block, 0, sizeof(data_block));
+        const char *tail = data_entry_bytes(buffer, entry, &data_block.size);
+        memcpy(data_block.name, tail, data_block.size);
+        int copy = store_fragment(buffer, bitmap, data_block.name, data_block.size, block_id);
+        if (copy == -1) {
+            copy = store_data_block(buffer, bitmap, &data_block, block_id);
+        }
+        inode = (struct heartyfs_inode *)heartyfs_block(buffer, block_id);
+        if (copy == -1) {
+            fprintf(stderr, "Error: No free blocks available\n");
+            inode->data_blocks[i] = -1;
+            release_inode_blocks(buffer, bitmap, inode);
+            heartyfs_clear_blocks(buffer, block_id, 1);
+            set_block_free(bitmap, block_id);
+            return -1;
+        }
+        inode->data_blocks[i] = copy;
+    }
+    return block_id;
+}
+
+/**
+ * @brief Open a file for buffered writes. Nothing is allocated until wb_flush.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param path - The path of the file in the heartyfs
+ * @param truncate - 1 to start from an empty file, 0 to keep the current content
+ * @return struct heartyfs_wb_file* - The write-back file, NULL if failed
+ */
+struct heartyfs_wb_file *wb_open(void *buffer, const char *path, int truncate) {
+    struct heartyfs_inode *inode;
+    int inode_block_id = find_inode_by_path(buffer, path, &inode);
+    if (inode_block_id == -1) {
+        fprintf(stderr, "Error: File %s does not exist in heartyfs\n", path);
+        return NULL;
+    }
+    if (inode->type != 0) {
+        fprintf(stderr, "Error: %s is not a regular file\n", path);
+        return NULL;
+    }
+
+    struct heartyfs_directory *parent_dir;
+    struct heartyfs_wb_file *file = calloc(1, sizeof(struct heartyfs_wb_file));
+    file->inode_block_id = inode_block_id;
+    file->truncate = truncate;
+    find_parent_directory_and_file_index(buffer, path, &parent_dir, &file->entry_index);
+    file->parent_block_id = parent_dir->entries[0].block_id;
+    inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
+    if (truncate) {
+        return file;
+    }
+
+    // Keep the current content so partial writes only dirty the chunks they touch
+    file->size = inode->size;
+    for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+        if (inode->data_blocks[i] != HOLE_BLOCK) {
+            int length;
+            const char *data = data_entry_bytes(buffer, inode->data_blocks[i], &length);
+            memcpy(file->data + i * DATA_BLOCK_NAME_SIZE, data, length);
+        }
+    }
+    return file;
+}
+
+/**
+ * @brief Write into the file's buffer, growing it if needed
+ * 
+ * @param file - The write-back file
+ * @param offset - The byte offset to write at
+ * @param data - The bytes to write
+ * @param length - The number of bytes to write
+ * @return int - 0 if successful, -1 if the file would exceed the heartyfs limit
+ */
+int wb_write(struct heartyfs_wb_file *file, int offset, const char *data, int length) {
+    if (offset < 0 || offset + length > INODE_BLOCKS * DATA_BLOCK_NAME_SIZE) {
+        fprintf(stderr, "Error: File size exceeds heartyfs limit\n");
+        return -1;
+    }
+    memcpy(file->data + offset, data, length);
+    for (int i = offset / DATA_BLOCK_NAME_SIZE; i * DATA_BLOCK_NAME_SIZE < offset + length; i++) {
+        file->dirty[i] = 1;
+    }
+    if (offset + length > file->size) {
+        file->size = offset + length;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy one chunk of a write-back file into a data block
+ * 
+ * @param file - The write-back file
+ * @param chunk - The chunk index
+ * @param data_block - Filled with the chunk, the rest of the block zeroed
+ * @return int - 1 if the chunk is all zeros, 0 otherwise
+ */
+static int load_chunk(const struct heartyfs_wb_file *file, int chunk, struct heartyfs_data_block *data_block) {
+    int chunk_size = (file->size - chunk * DATA_BLOCK_NAME_SIZE > DATA_BLOCK_NAME_SIZE) ? DATA_BLOCK_NAME_SIZE : file->size - chunk * DATA_BLOCK_NAME_SIZE;
+    memset(data_block, 0, sizeof(*data_block));
+    data_block->size = chunk_size;
+    memcpy(data_block->name, file->data + chunk * DATA_BLOCK_NAME_SIZE, chunk_size);
+    for (int j = 0; j < chunk_size; j++) {
+        if (data_block->name[j] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Check whether a data_blocks[] entry is a whole block owned by this inode alone
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param entry - The data_blocks[] value
+ * @return int - 1 if it is a private block, 0 for holes, packed tails and shared blocks
+ */
+static int is_private_block(void *buffer, int entry) {
+    if (entry == -1 || entry == HOLE_BLOCK || IS_FRAGMENT(entry)) {
+        return 0;
+    }
+    struct heartyfs_block_ref *ref = get_block_ref(buffer, entry);
+    return (ref == NULL || ref->refs <= 1);
+}
+
+/**
+ * @brief Check whether a data_blocks[] entry is a private block reserved by preallocation
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param entry - The data_blocks[] value
+ * @return int - 1 if it is a reserved block, 0 otherwise
+ */
+static int is_reserved_block(void *buffer, int entry) {
+    if (!is_private_block(buffer, entry)) {
+        return 0;
+    }
+    struct heartyfs_data_block *data_block = (struct heartyfs_data_block *)heartyfs_block(buffer, entry);
+    return (data_block->size & DATA_BLOCK_RESERVED) != 0;
+}
+
+/**
+ * @brief Allocate blocks for the dirty chunks and write them out. Blocks reserved by
+ * preallocation are overwritten in place, zeros too, so they keep their place. Otherwise
+ * chunks of zeros become holes, other private blocks are overwritten in place by an
+ * offset write, a short tail is packed into a fragment block and everything else gets
+ * one contiguous run chosen for the whole file at once.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param file - The write-back file
+ * @return int - 0 if successful, -1 if failed
+ */
+int wb_flush(void *buffer, unsigned char *bitmap, struct heartyfs_wb_file *file) {
+    struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, file->inode_block_id);
+    int num_chunks = (file->size + DATA_BLOCK_NAME_SIZE - 1) / DATA_BLOCK_NAME_SIZE;
+    int old_blocks[INODE_BLOCKS];
+    int pending[INODE_BLOCKS];
+    int num_pending = 0;
+    struct heartyfs_data_block data_block;
+
+    memcpy(old_blocks, inode->data_blocks, sizeof(old_blocks));
+    if (file->truncate) {
+        for (int i = 0; i < INODE_BLOCKS; i++) {
+            file->dirty[i] = (i < num_chunks);
+        }
+    }
+
+    // Old blocks are released before their replacements are placed, so make sure every
+    // chunk that needs a new block gets one before letting go of anything
+    int needed = 0;
+    int released = 0;
+    for (int i = 0; i < INODE_BLOCKS && (i < num_chunks || old_blocks[i] != -1); i++) {
+        int private_block = is_private_block(buffer, old_blocks[i]);
+        if (i >= num_chunks) {
+            released += private_block;
+            continue;
+        }
+        if (is_reserved_block(buffer, old_blocks[i])) {
+            continue;  // Overwritten in place
+        }
+        if (file->truncate) {
+            released += private_block;
+        }
+        if (!file->dirty[i] || load_chunk(file, i, &data_block)) {
+            continue;
+        }
+        if (!file->truncate) {
+            if (private_block && !dedup_enabled(bitmap)) {
+                continue;  // Overwritten in place
+            }
+            if (dedup_enabled(bitmap) && dedup_find_block(buffer, &data_block, hash_data_block(&data_block)) != -1) {
+                continue;  // Shared with an identical block
+            }
+            released += private_block;
+        }
+        needed++;
+    }
+    if (needed > count_free_blocks(bitmap) + released) {
+        fprintf(stderr, "Error: No free blocks available\n");
+        return -1;
+    }
+
+    // A full rewrite gives back every block but the reserved ones first, so it is laid
+    // out like a fresh write, and a shorter file gives back the blocks past its end
+    for (int i = 0; i < INODE_BLOCKS && old_blocks[i] != -1; i++) {
+        if (i < num_chunks && (!file->truncate || is_reserved_block(buffer, old_blocks[i]))) {
+            continue;
+        }
+        if (old_blocks[i] != HOLE_BLOCK) {
+            release_data_block(buffer, bitmap, old_blocks[i]);
+        }
+        inode = (struct heartyfs_inode *)heartyfs_block(buffer, file->inode_block_id);
+        inode->data_blocks[i] = -1;
+        old_blocks[i] = -1;
+    }
+
+    for (int i = 0; i < num_chunks; i++) {
+        if (!file->dirty[i]) {
+            continue;
+        }
+        int zeros = load_chunk(file, i, &data_block);
+        int chunk_size = data_block.size;
+        int old_block_id = old_blocks[i];
+        if (is_reserved_block(buffer, old_block_id)) {
+            // Overwritten in place, zeros too, and it stays reserved
+            data_block.size |= DATA_BLOCK_RESERVED;
+            place_data_block(buffer, bitmap, old_block_id, &data_block);
+            continue;
+        }
+
+        int fragment;
+        inode = (struct heartyfs_inode *)heartyfs_block(buffer, file->inode_block_id);
+        if (zeros) {
+            inode->data_blocks[i] = HOLE_BLOCK;
+        } else if (is_private_block(buffer, old_block_id) && !dedup_enabled(bitmap)) {
+            place_data_block(buffer, bitmap, old_block_id, &data_block);
+            continue;
+        } else if ((fragment = store_fragment(buffer, bitmap, data_block.name, chunk_size, file->inode_block_id)) != -1) {
+            // A short tail shares a fragment block instead of taking a whole one
+            inode = (struct heartyfs_inode *)heartyfs_block(buffer, file->inode_block_id);
+            inode->data_blocks[i] = fragment;
+        } else {
+            int block_id = share_identical_block(buffer, bitmap, &data_block);
+            inode = (struct heartyfs_inode *)heartyfs_block(buffer, file->inode_block_id);
+            if (block_id != -1) {
+                inode->data_blocks[i] = block_id;
+            } else {
+                pending[num_pending++] = i;
+            }
+        }
+        if (old_block_id != -1 && old_block_id != HOLE_BLOCK) {
+            release_data_block(buffer, bitmap, old_block_id);
+        }
+    }
+
+    // Choose blocks for everything still unplaced in one go, right after the inode if it
+    // fits, or after the block before the first unplaced chunk when a rewrite kept that one
+    int previous = file->inode_block_id;
+    if (num_pending > 0 && pending[0] > 0 && inode->data_blocks[pending[0] - 1] > HOLE_BLOCK) {
+        previous = inode->data_blocks[pending[0] - 1];
+    }
+    int run_start = find_free_run_near(bitmap, num_pending, previous);
+    for (int p = 0; p < num_pending; p++) {
+        int i = pending[p];
+        int block_id = (run_start != -1) ? run_start + p : find_free_block_near(bitmap, previous);
+        previous = block_id;
+        if (block_id == -1) {
+            fprintf(stderr, "Error: No free blocks available\n");
+            for (; p < num_pending; p++) {
+                inode->data_blocks[pending[p]] = HOLE_BLOCK;
+            }
+            return -1;
+        }
+        load_chunk(file, i, &data_block);
+        place_data_block(buffer, bitmap, block_id, &data_block);
+        inode->data_blocks[i] = block_id;
+    }
+
+    for (int i = 0; i < num_chunks; i++) {
+        if (inode->data_blocks[i] == -1) {
+            inode->data_blocks[i] = HOLE_BLOCK;
+        }
+        file->dirty[i] = 0;
+    }
+    inode->size = file->size;
+    struct heartyfs_directory *parent_dir = (struct heartyfs_directory *)heartyfs_block(buffer, file->parent_block_id);
+    parent_dir->entry_info[file->entry_index] = entry_info_of(inode);
+    stamp_generation(buffer, file->inode_block_id, file->parent_block_id);
+    file->truncate = 0;
+    return 0;
+}
+
+/**
+ * @brief Flush and free a write-back file
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param file - The write-back file
+ * @return int - 0 if successful, -1 if the flush failed
+ */
+int wb_close(void *buffer, unsigned char *bitmap, struct heartyfs_wb_file *file) {
+    int result = wb_flush(buffer, bitmap, file);
+    free(file);
+    return result;
+}
+
+/**
+ * @brief Free a write-back file without writing it, no block is ever allocated
+ * for its buffered data
+ * 
+ * @param file - The write-back file
+ */
+void wb_discard(struct heartyfs_wb_file *file) {
+    free(file);
+}
+
+/**
+ * @brief Find a file's inode and its entry in the parent directory
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param path - The path of the file
+ * @param parent_block_id - Set to the block number of the parent directory
+ * @param entry_index - Set to the index of the file in the parent directory
+ * @return int - The block number of the inode, -1 if it is missing or not a regular file
+ */
+static int find_regular_file(void *buffer, const char *path, int *parent_block_id, int *entry_index) {
+    struct heartyfs_directory *parent_dir;
+    int inode_block_id = find_parent_directory_and_file_index(buffer, path, &parent_dir, entry_index);
+    if (inode_block_id == -1) {
+        fprintf(stderr, "Error: File %s does not exist in heartyfs\n", path);
+        return -1;
+    }
+    *parent_block_id = parent_dir->entries[0].block_id;
+    struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
+    if (inode->type != 0) {
+        fprintf(stderr, "Error: %s is not a regular file\n", path);
+        return -1;
+    }
+    return inode_block_id;
+}
+
+/**
+ * @brief Set the size of a file. Shrinking frees the data blocks past the new end and
+ * clears the cut part of the last block, growing adds holes that read as zeros.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param path - The path of the file in the heartyfs
+ * @param size - The new size in bytes
+ * @return int - 0 if successful, -1 if failed
+ */
+int truncate_file(void *buffer, unsigned char *bitmap, const char *path, int size) {
+    if (size < 0 || size > INODE_BLOCKS * DATA_BLOCK_NAME_SIZE) {
+        fprintf(stderr, "Error: File size exceeds heartyfs limit\n");
+        return -1;
+    }
+    int parent_block_id, entry_index;
+    int inode_block_id = find_regular_file(buffer, path, &parent_block_id, &entry_index);
+    if (inode_block_id == -1) {
+        return -1;
+    }
+
+    struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
+    int num_chunks = (size + DATA_BLOCK_NAME_SIZE - 1) / DATA_BLOCK_NAME_SIZE;
+
+    // The last kept block may hold bytes past the new end, which must read as zeros later
+    int tail = size - (num_chunks - 1) * DATA_BLOCK_NAME_SIZE;
+    int last_block_id = (num_chunks > 0) ? inode->data_blocks[num_chunks - 1] : -1;
+    int last_length = 0;
+    const char *last_data = NULL;
+    if (size < inode->size && last_block_id != -1 && last_block_id != HOLE_BLOCK) {
+        last_data = data_entry_bytes(buffer, last_block_id, &last_length);
+    }
+    if (last_data != NULL && last_length > tail) {
+        struct heartyfs_data_block data_block;
+        memset(&data_block, 0, sizeof(data_block));
+        data_block.size = tail;
+        memcpy(data_block.name, last_data, tail);
+        int zeros = 1;
+        for (int j = 0; j < tail && zeros; j++) {
+            zeros = (data_block.name[j] == 0);
+        }
+
+        struct heartyfs_block_ref *ref = IS_FRAGMENT(last_block_id) ? NULL : get_block_ref(buffer, last_block_id);
+        int new_block_id;
+        if (zeros) {
+            new_block_id = HOLE_BLOCK;
+        } else if ((new_block_id = store_fragment(buffer, bitmap, data_block.name, tail, inode_block_id)) != -1) {
+            // The cut tail is short enough to pack
+        } else if (!IS_FRAGMENT(last_block_id) && !dedup_enabled(bitmap) && (ref == NULL || ref->refs <= 1)) {
+            memcpy(heartyfs_block(buffer, last_block_id), &data_block, BLOCK_SIZE);
+            record_block_checksum(buffer, last_block_id);
+            new_block_id = last_block_id;
+        } else if ((new_block_id = store_data_block(buffer, bitmap, &data_block, data_block_of(last_block_id))) == -1) {
+            fprintf(stderr, "Error: No free blocks available\n");
+            return -1;
+        }
+        if (new_block_id != last_block_id) {
+            release_data_block(buffer, bitmap, last_block_id);
+        }
+        inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
+        inode->data_blocks[num_chunks - 1] = new_block_id;
+    }
+
+    for (int i = num_chunks; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+        if (inode->data_blocks[i] != HOLE_BLOCK) {
+            release_data_block(buffer, bitmap, inode->data_blocks[i]);
+            inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
+        }
+        inode->data_blocks[i] = -1;
+    }
+    for (int i = 0; i < num_chunks; i++) {
+        if (inode->data_blocks[i] == -1) {
+            inode->data_blocks[i] = HOLE_BLOCK;
+        }
+    }
+    inode->size = size;
+
+    struct heartyfs_directory *parent_dir = (struct heartyfs_directory *)heartyfs_block(buffer, parent_block_id);
+    parent_dir->entry_info[entry_index] = entry_info_of(heartyfs_block(buffer, inode_block_id));
+    stamp_generation(buffer, inode_block_id, parent_block_id);
+    return 0;
+}
+
+/**
+ * @brief Reserve blocks for every hole of a file up to a size, growing it if needed.
+ * The blocks are taken as one contiguous run when there is one and read as zeros
+ * until written. They are marked reserved, so later writes overwrite them in place.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param path - The path of the file in the heartyfs
+ * @param size - The size to reserve blocks for
+ * @return int - The number of blocks reserved, -1 if failed
+ */
+int preallocate_file(void *buffer, unsigned char *bitmap, const char *path, int size) {
+    int parent_block_id, entry_index;
+    int inode_block_id = find_regular_file(buffer, path, &parent_block_id, &entry_index);
+    if (inode_block_id == -1) {
+        return -1;
+    }
+    struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
+    if (size > inode->size && truncate_file(buffer, bitmap, path, size) != 0) {
+        return -1;
+    }
+
+    inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
+    int num_chunks = (size + DATA_BLOCK_NAME_SIZE - 1) / DATA_BLOCK_NAME_SIZE;
+    int holes[INODE_BLOCKS];
+    int num_holes = 0;
+    for (int i = 0; i < num_chunks; i++) {
+        if (inode->data_blocks[i] == HOLE_BLOCK) {
+            holes[num_holes++] = i;
+        }
+    }
+    if (num_holes > count_free_blocks(bitmap)) {
+        fprintf(stderr, "Error: No free blocks available\n");
+        return -1;
+    }
+
+    // An empty data block reads as zeros, like the hole it replaces, and the flag keeps
+    // later writes on it
+    struct heartyfs_data_block data_block;
+    memset(&data_block, 0, sizeof(data_block));
+    data_block.size = DATA_BLOCK_RESERVED;
+    int run_start = find_free_run_near(bitmap, num_holes, inode_block_id);
+    int previous = inode_block_id;
+    for (int h = 0; h < num_holes; h++) {
+        int block_id = (run_start != -1) ? run_start + h : find_free_block_near(bitmap, previous);
+        previous = block_id;
+        place_data_block(buffer, bitmap, block_id, &data_block);
+        inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
+        inode->data_blocks[holes[h]] = block_id;
+    }
+    return num_holes;
+}
+
+/**
+ * @brief Append a block number to a block list
+ * 
+ * @param list - The list to append to
+ * @param block_id - The block number
+ */
+void block_list_add(struct heartyfs_block_list *list, int block_id) {
+    if (list->count == list->capacity) {
+        list->capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+        list->blocks = realloc(list->blocks, list->capacity * sizeof(int));
+    }
+    list->blocks[list->count++] = block_id;
+}
+
+static int compare_block_ids(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * @brief Free every block of a list in the bitmap. The list is sorted and each run
+ * of consecutive blocks is freed and cleared as one range, queued as one range in
+ * discard mode and zeroed otherwise.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param list - The blocks to free, sorted in place
+ * @return int - The number of ranges freed
+ */
+int free_block_list(void *buffer, unsigned char *bitmap, struct heartyfs_block_list *list) {
+    qsort(list->blocks, list->count, sizeof(int), compare_block_ids);
+
+    int ranges = 0;
+    int i = 0;
+    while (i < list->count) {
+        int start = list->blocks[i];
+        int length = 1;
+        while (i + length < list->count && list->blocks[i + length] == start + length) {
+            length++;
+        }
+        set_block_range_free(bitmap, start, length);
+        heartyfs_clear_blocks(buffer, start, length);
+        ranges++;
+        i += length;
+    }
+    return ranges;
+}
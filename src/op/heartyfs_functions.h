@@ -14,12 +14,171 @@
 
 #include "../heartyfs.h"
 
+// A growable list of block numbers
+struct heartyfs_block_list {
+    int *blocks;
+    int count;
+    int capacity;
+};
+
+// A file opened for buffered writes, blocks are only chosen when it is flushed
+struct heartyfs_wb_file {
+    int inode_block_id;
+    int truncate;                   // Old blocks are dropped at flush
+    int parent_block_id;            // Directory whose entry_info mirrors the size
+    int entry_index;
+    int size;                       // Buffered file size in bytes
+    unsigned char dirty[INODE_BLOCKS];
+    char data[INODE_BLOCKS * DATA_BLOCK_NAME_SIZE];
+};
+
+// Allocation keeps each directory's inodes and data together in one block group
+#define BLOCKS_PER_GROUP 256
+#define NUM_GROUPS (NUM_BLOCK / BLOCKS_PER_GROUP)
+
 int find_free_block(unsigned char *bitmap);
+int find_free_block_near(unsigned char *bitmap, int goal);
+int find_free_run_near(unsigned char *bitmap, int count, int goal);
+int directory_goal(unsigned char *bitmap, int parent_block_id);
 void set_block_used(unsigned char *bitmap, int block_num);
 void set_block_free(unsigned char *bitmap, int block_num);
+void set_block_range_free(unsigned char *bitmap, int start, int count);
+void block_list_add(struct heartyfs_block_list *list, int block_id);
+int free_block_list(void *buffer, unsigned char *bitmap, struct heartyfs_block_list *list);
 // int find_file(void *buffer, const char *path, struct heartyfs_inode **inode);
 int find_inode_by_path(void *buffer, const char *path, struct heartyfs_inode **inode);
 
  int find_parent_directory_and_file_index(void *buffer, const char *path, struct heartyfs_directory **parent_dir, int *file_index);
 
+struct heartyfs_info *get_info(unsigned char *bitmap);
+int find_free_run(unsigned char *bitmap, int count);
+int count_free_blocks(unsigned char *bitmap);
+int find_directory_by_path(void *buffer, const char *path, struct heartyfs_directory **dir);
+int add_directory_entry(struct heartyfs_directory *dir, int block_id, const char *name, unsigned short info);
+void remove_directory_entry(struct heartyfs_directory *dir, int index);
+unsigned short entry_info_of(void *entry_block);
+
+// Block reference table and content deduplication
+int create_ref_table(void *buffer, unsigned char *bitmap);
+struct heartyfs_block_ref *get_block_ref(void *buffer, int block_id);
+unsigned int hash_data_block(const struct heartyfs_data_block *data_block);
+int share_identical_block(void *buffer, unsigned char *bitmap, const struct heartyfs_data_block *data_block);
+void place_data_block(void *buffer, unsigned char *bitmap, int block_id, const struct heartyfs_data_block *data_block);
+int store_data_block(void *buffer, unsigned char *bitmap, const struct heartyfs_data_block *data_block, int goal);
+int drop_block_ref(void *buffer, int block_id);
+void release_data_block(void *buffer, unsigned char *bitmap, int block_id);
+void release_inode_blocks(void *buffer, unsigned char *bitmap, struct heartyfs_inode *inode);
+
+// Tail packing into fragment blocks
+int data_block_of(int entry);
+const char *data_entry_bytes(void *buffer, int entry, int *length);
+int store_fragment(void *buffer, unsigned char *bitmap, const char *data, int length, int goal);
+
+// Change generations
+int create_generation_table(void *buffer, unsigned char *bitmap);
+unsigned int *get_block_generation(void *buffer, int block_id);
+void stamp_generation(void *buffer, int block_id, int parent_block_id);
+unsigned int *get_link_generation(void *buffer, int block_id);
+void stamp_moved_directory(void *buffer, int dir_block_id, int parent_block_id);
+
+// Copy-on-write clones
+void share_data_block(void *buffer, int block_id);
+int clone_inode(void *buffer, unsigned char *bitmap, int src_block_id, const char *name, int parent_block_id);
+
+// Delayed allocation for buffered writes
+struct heartyfs_wb_file *wb_open(void *buffer, const char *path, int truncate);
+int wb_write(struct heartyfs_wb_file *file, int offset, const char *data, int length);
+int wb_flush(void *buffer, unsigned char *bitmap, struct heartyfs_wb_file *file);
+int wb_close(void *buffer, unsigned char *bitmap, struct heartyfs_wb_file *file);
+void wb_discard(struct heartyfs_wb_file *file);
+
+// Truncation and preallocation
+int truncate_file(void *buffer, unsigned char *bitmap, const char *path, int size);
+int preallocate_file(void *buffer, unsigned char *bitmap, const char *path, int size);
+
+// Block layer over the disk file (heartyfs_disk.c)
+#define HEARTYFS_RDONLY 0
+#define HEARTYFS_RDWR 1
+#define HEARTYFS_MAX_STRIPES 16
+int heartyfs_create_stripes(char **paths, int count, int unit_blocks);
+void *heartyfs_mount(int mode);
+void *heartyfs_block(void *buffer, int block_id);
+int heartyfs_flat_mapping(void);
+off_t heartyfs_block_location(int block_id, int *stripe);
+int heartyfs_stripes(int *unit_blocks);
+int heartyfs_sync(void *buffer);
+int heartyfs_discard_blocks(int first_block, int num_blocks);
+void heartyfs_clear_blocks(void *buffer, int first_block, int num_blocks);
+long long heartyfs_host_usage(void);
+int heartyfs_resize_backing(int num_blocks);
+void heartyfs_unmount(void *buffer);
+void heartyfs_prefetch_blocks(void *buffer, const int *blocks, int num_blocks);
+void heartyfs_prefetch_file(void *buffer, struct heartyfs_inode *inode);
+
+// Block checksums (heartyfs_checksum.c)
+unsigned int crc32c(const void *data, size_t length);
+void crc32c_blocks(const void *const *blocks, int count, unsigned int *crcs);
+int create_checksum_table(void *buffer, unsigned char *bitmap);
+unsigned int *get_block_checksum(void *buffer, int block_id);
+void record_block_checksum(void *buffer, int block_id);
+int verify_data_blocks(void *buffer, const int *blocks, int count, int *bad_block);
+
+// Operation trace and phase timing (heartyfs_trace.c)
+void heartyfs_trace_start(int argc, char *argv[]);
+void heartyfs_trace_bytes(long long bytes);
+#define HEARTYFS_PHASE_MOUNT 0
+#define HEARTYFS_PHASE_RESOLVE 1
+#define HEARTYFS_PHASE_ALLOC 2
+#define HEARTYFS_PHASE_COPY 3
+#define HEARTYFS_PHASE_SYNC 4
+#define HEARTYFS_NUM_PHASES 5
+void heartyfs_phase_begin(int phase);
+void heartyfs_phase_end(void);
+
+// Parallel tree walker (heartyfs_walk.c)
+#define HEARTYFS_PATH_MAX 1024
+struct heartyfs_walk_entry {
+    int block_id;
+    int parent_block_id;
+    int depth;                      // 0 for the directory the walk starts at
+    unsigned short info;            // ENTRY_INFO_DIRECTORY or the file size
+    char path[HEARTYFS_PATH_MAX];
+};
+typedef void (*heartyfs_walk_visit)(void *buffer, const struct heartyfs_walk_entry *entry, void *state);
+int heartyfs_walk(void *buffer, const char *path, int num_threads, heartyfs_walk_visit visit, void **states);
+
+// Batched reads of many files (heartyfs_batch.c)
+#define HEARTYFS_BATCH_OK 0
+#define HEARTYFS_BATCH_MISSING 1      // Not found or not a regular file
+#define HEARTYFS_BATCH_CORRUPTED 2    // A data block failed its checksum
+struct heartyfs_batch_file {
+    const char *path;
+    int status;
+    int size;
+    char *data;                     // The content, NULL unless the status is HEARTYFS_BATCH_OK
+};
+int heartyfs_read_batch(void *buffer, struct heartyfs_batch_file *files, int count);
+void heartyfs_batch_free(struct heartyfs_batch_file *files, int count);
+
+// Buffered stdout (heartyfs_output.c)
+int heartyfs_output_open(void);
+int heartyfs_flush_output(void);
+int heartyfs_emit(const void *data, size_t length);
+long long heartyfs_output_total(void);
+void heartyfs_output_close(void);
+
+// Zero-copy read views (heartyfs_view.c)
+struct heartyfs_span {
+    const char *data;
+    int length;
+};
+struct heartyfs_view {
+    int size;                       // File size in bytes, the sum of the span lengths
+    int count;
+    struct heartyfs_span *spans;    // The content in order, holes point at shared zeros
+    char *copy;                     // The content copied out when the image is not mapped flat
+};
+int heartyfs_view_open(void *buffer, const char *path, struct heartyfs_view *view);
+void heartyfs_view_close(struct heartyfs_view *view);
+
 #endif // HEARTYFS_FUNCTIONS_H
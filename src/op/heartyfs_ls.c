@@ -1,4 +1,5 @@
 #include "../heartyfs.h"
+#include "heartyfs_functions.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,8 +7,28 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 
-void list_directory(void *buffer, const char *path) {
-    struct heartyfs_directory *current_dir = (struct heartyfs_directory *)buffer; // Start at root
+/**
+ * @brief Print the type and size of every entry. Images made with
+ * HEARTYFS_FEATURE_ENTRY_INFO are served from the directory block alone.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param dir - The directory to list
+ */
+void print_long_listing(void *buffer, struct heartyfs_directory *dir) {
+    struct heartyfs_info *info = get_info((unsigned char *)heartyfs_block(buffer, 1));
+    int cached = (info != NULL && (info->features & HEARTYFS_FEATURE_ENTRY_INFO));
+    for (int i = 0; i < dir->size; i++) {
+        unsigned short entry = cached ? dir->entry_info[i] : entry_info_of(heartyfs_block(buffer, dir->entries[i].block_id));
+        if (entry == ENTRY_INFO_DIRECTORY) {
+            printf("d %8s %s\n", "-", dir->entries[i].file_name);
+        } else {
+            printf("f %8u %s\n", entry, dir->entries[i].file_name);
+        }
+    }
+}
+
+void list_directory(void *buffer, const char *path, int long_format) {
+    struct heartyfs_directory *current_dir = (struct heartyfs_directory *)heartyfs_block(buffer, 0); // Start at root
 
     // If path is not root, find the correct directory
     if (strcmp(path, "/") != 0) {
@@ -18,7 +39,7 @@ void list_directory(void *buffer, const char *path) {
             int found = 0;
             for (int i = 0; i < current_dir->size; i++) {
                 if (strcmp(current_dir->entries[i].file_name, token) == 0) {
-                    current_dir = (struct heartyfs_directory *)((char *)buffer + current_dir->entries[i].block_id * BLOCK_SIZE);
+                    current_dir = (struct heartyfs_directory *)heartyfs_block(buffer, current_dir->entries[i].block_id);
                     found = 1;
                     break;
                 }
@@ -35,9 +56,13 @@ void list_directory(void *buffer, const char *path) {
 
     // List contents of the directory
     printf("Contents of directory %s:\n", path);
+    if (long_format) {
+        print_long_listing(buffer, current_dir);
+        return;
+    }
     for (int i = 0; i < current_dir->size; i++) {
-        struct heartyfs_directory *entry_dir = (struct heartyfs_directory *)((char *)buffer + current_dir->entries[i].block_id * BLOCK_SIZE);
-        struct heartyfs_inode *entry_inode = (struct heartyfs_inode *)((char *)buffer + current_dir->entries[i].block_id * BLOCK_SIZE);
+        struct heartyfs_directory *entry_dir = (struct heartyfs_directory *)heartyfs_block(buffer, current_dir->entries[i].block_id);
+        struct heartyfs_inode *entry_inode = (struct heartyfs_inode *)heartyfs_block(buffer, current_dir->entries[i].block_id);
         
         if (entry_dir->type == 1) { // Directory
             printf("d %s\n", current_dir->entries[i].file_name);
@@ -50,30 +75,21 @@ void list_directory(void *buffer, const char *path) {
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <directory_path>\n", argv[0]);
+    heartyfs_trace_start(argc, argv);
+    int long_format = (argc == 3 && strcmp(argv[1], "-l") == 0);
+    if (argc != 2 && !long_format) {
+        fprintf(stderr, "Usage: %s [-l] <directory_path>\n", argv[0]);
         return 1;
     }
 
-    int fd = open(DISK_FILE_PATH, O_RDONLY);
-    if (fd < 0) {
-        perror("Error: Cannot open the disk file");
+    void *buffer = heartyfs_mount(HEARTYFS_RDONLY);
+    if (buffer == NULL) {
         return 1;
     }
 
-    void *buffer = mmap(NULL, DISK_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("Error: Cannot map the disk file onto memory");
-        close(fd);
-        return 1;
-    }
+    list_directory(buffer, argv[argc - 1], long_format);
 
-    list_directory(buffer, argv[1]);
-
-    if (munmap(buffer, DISK_SIZE) == -1) {
-        perror("Error: Failed to unmap file");
-    }
-    close(fd);
+    heartyfs_unmount(buffer);
 
     return 0;
 }
\ No newline at end of file
@@ -24,7 +24,7 @@
  * @return int - 1 if initialized, 0 otherwise
  */
 int is_initialized(void *buffer) {
-    struct heartyfs_directory *root = (struct heartyfs_directory *)buffer;
+    struct heartyfs_directory *root = (struct heartyfs_directory *)heartyfs_block(buffer, 0);
     return (root->type == 1 && strcmp(root->name, "/") == 0);
 }
 
@@ -37,9 +37,10 @@ int is_initialized(void *buffer) {
  * @return int - The block number of the directory, -1 if not found
  */
 int find_directory(void *buffer, const char *path, struct heartyfs_directory **dir) {
+    heartyfs_phase_begin(HEARTYFS_PHASE_RESOLVE);
     char *path_copy = strdup(path); // Copy the path to avoid modifying the original
     char *token = strtok(path_copy, "/"); // Tokenize the path by '/'
-    struct heartyfs_directory *current = buffer; // Start from the root directory
+    struct heartyfs_directory *current = heartyfs_block(buffer, 0); // Start from the root directory
     int block_id = 0; // Start from the root directory block
 
     // Traverse the path to find the directory
@@ -48,19 +49,21 @@ int find_directory(void *buffer, const char *path, struct heartyfs_directory **d
         for (int i = 0; i < current->size; i++) {
             if (strcmp(current->entries[i].file_name, token) == 0) {
                 block_id = current->entries[i].block_id;
-                current = (struct heartyfs_directory *)((char *)buffer + block_id * BLOCK_SIZE);
+                current = (struct heartyfs_directory *)heartyfs_block(buffer, block_id);
                 found = 1; // Found the directory
                 break;
             }
         }
         if (!found) { // Directory not found
             free(path_copy);
+            heartyfs_phase_end();
             return -1;
         }
         token = strtok(NULL, "/"); // Move to the next token
     }
     *dir = current;
     free(path_copy);
+    heartyfs_phase_end();
     return block_id;
 }
 
@@ -110,8 +113,8 @@ int create_directory(void *buffer, unsigned char *bitmap, const char *path) {
         return -1;
     }
 
-    // Get a free block
-    int new_block_id = find_free_block(bitmap);
+    // Get a free block, top-level directories spread over the block groups
+    int new_block_id = find_free_block_near(bitmap, directory_goal(bitmap, parent_block_id));
     if (new_block_id == -1) {
         fprintf(stderr, "Error: No free blocks available\n");
         free(path_copy);
@@ -123,7 +126,7 @@ int create_directory(void *buffer, unsigned char *bitmap, const char *path) {
     set_block_used(bitmap, new_block_id);
 
     // Initialize the new directory block
-    struct heartyfs_directory *new_dir = (struct heartyfs_directory *)((char *)buffer + new_block_id * BLOCK_SIZE);
+    struct heartyfs_directory *new_dir = (struct heartyfs_directory *)heartyfs_block(buffer, new_block_id);
     new_dir->type = 1;
     strncpy(new_dir->name, dir_name, sizeof(new_dir->name) - 1);
     new_dir->size = 2;
@@ -135,11 +138,15 @@ int create_directory(void *buffer, unsigned char *bitmap, const char *path) {
     // Set .. entry
     new_dir->entries[1].block_id = parent_block_id;
     strcpy(new_dir->entries[1].file_name, "..");
+    new_dir->entry_info[0] = ENTRY_INFO_DIRECTORY;
+    new_dir->entry_info[1] = ENTRY_INFO_DIRECTORY;
 
     // Add new entry to parent directory
     parent_dir->entries[parent_dir->size].block_id = new_block_id;
     strncpy(parent_dir->entries[parent_dir->size].file_name, dir_name, sizeof(parent_dir->entries[parent_dir->size].file_name) - 1);
+    parent_dir->entry_info[parent_dir->size] = ENTRY_INFO_DIRECTORY;
     parent_dir->size++;
+    stamp_generation(buffer, new_block_id, parent_block_id);
 
     free(path_copy);
     free(parent_path);
@@ -147,34 +154,26 @@ int create_directory(void *buffer, unsigned char *bitmap, const char *path) {
 }
 
 int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
     printf("heartyfs_mkdir\n");
     if (argc != 2) {
         fprintf(stderr, "Usage: %s <directory_path>\n", argv[0]);
         return 1;
     }
 
-    int fd = open(DISK_FILE_PATH, O_RDWR);
-    if (fd < 0) {
-        perror("Error: Cannot open the disk file");
-        return 1;
-    }
-
-    void *buffer = mmap(NULL, DISK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("Error: Cannot map the disk file onto memory");
-        close(fd);
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
         return 1;
     }
 
     // Check if heartyfs is initialized
     if (!is_initialized(buffer)) {
         fprintf(stderr, "Error: heartyfs is not initialized\n");
-        munmap(buffer, DISK_SIZE);
-        close(fd);
+        heartyfs_unmount(buffer);
         return 1;
     }
 
-    unsigned char *bitmap = (unsigned char *)buffer + BLOCK_SIZE;
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
 
     if (create_directory(buffer, bitmap, argv[1]) == 0) {
         printf("Success: Directory %s created successfully\n", argv[1]);
@@ -182,14 +181,9 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error: Failed to create directory %s\n", argv[1]);
     }
 
-    if (msync(buffer, DISK_SIZE, MS_SYNC) == -1) {
-        perror("Error: Failed to sync changes to disk");
-    }
+    heartyfs_sync(buffer);
 
-    if (munmap(buffer, DISK_SIZE) == -1) {
-        perror("Error: Failed to unmap file");
-    }
-    close(fd);
+    heartyfs_unmount(buffer);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,166 @@
+/**
+ * @file heartyfs_mv.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file moves or renames a file or a directory subtree in the heartyfs file
+ * system. Only the directory entry is relinked from the old parent to the new one, so
+ * the data is never copied and a move of any size writes the two parent directories
+ * and the moved block itself (its name, and ".." for a directory). With change
+ * generations a moved directory only records the move in its own link generation,
+ * the export then sends everything below it.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+
+/**
+ * @brief Check whether a directory lies inside a subtree, following ".." up to the root
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param dir_block_id - The directory
+ * @param subtree_block_id - The top directory of the subtree
+ * @return int - 1 if dir_block_id is subtree_block_id or below it, 0 otherwise
+ */
+int is_inside(void *buffer, int dir_block_id, int subtree_block_id) {
+    for (int depth = 0; depth < NUM_BLOCK; depth++) {
+        if (dir_block_id == subtree_block_id) {
+            return 1;
+        }
+        if (dir_block_id == 0) {
+            return 0;
+        }
+        struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(buffer, dir_block_id);
+        dir_block_id = dir->entries[1].block_id;
+    }
+    return 0;
+}
+
+/**
+ * @brief Move a file or directory. If the destination is an existing directory the
+ * entry is moved into it under the same name, otherwise it takes the destination name.
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param src_path - The path of the file or directory to move
+ * @param dst_path - The new path, or an existing directory to move into
+ * @return int - 0 if successful, -1 if failed
+ */
+int move_entry(void *buffer, const char *src_path, const char *dst_path) {
+    if (dst_path[0] != '/') {
+        fprintf(stderr, "Error: Destination %s must be an absolute path\n", dst_path);
+        return -1;
+    }
+    struct heartyfs_directory *src_parent;
+    int src_index;
+    int block_id = find_parent_directory_and_file_index(buffer, src_path, &src_parent, &src_index);
+    if (block_id == -1 || src_index < 2) {
+        fprintf(stderr, "Error: %s does not exist or cannot be moved\n", src_path);
+        return -1;
+    }
+    int src_parent_id = src_parent->entries[0].block_id;
+    int is_dir = ((struct heartyfs_directory *)heartyfs_block(buffer, block_id))->type == 1;
+
+    // Resolve the destination parent and name
+    char *path_copy = strdup(dst_path);
+    char *parent_copy = strdup(dst_path);
+    char *parent_path = dirname(parent_copy);
+    char name[FILENAME_MAXLEN];
+    struct heartyfs_directory *dst_parent;
+    int dst_parent_id = find_directory_by_path(buffer, dst_path, &dst_parent);
+    if (dst_parent_id != -1) {
+        char *src_copy = strdup(src_path);
+        snprintf(name, sizeof(name), "%s", basename(src_copy));
+        free(src_copy);
+    } else {
+        dst_parent_id = find_directory_by_path(buffer, parent_path, &dst_parent);
+        snprintf(name, sizeof(name), "%s", basename(path_copy));
+    }
+    free(path_copy);
+    free(parent_copy);
+    if (dst_parent_id == -1) {
+        fprintf(stderr, "Error: Destination directory of %s does not exist\n", dst_path);
+        return -1;
+    }
+    if (strlen(name) == 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, "/") == 0) {
+        fprintf(stderr, "Error: %s is not a valid name\n", name);
+        return -1;
+    }
+
+    // A directory cannot move below itself, that would cut the subtree off the root
+    if (is_dir && is_inside(buffer, dst_parent_id, block_id)) {
+        fprintf(stderr, "Error: Cannot move %s inside itself\n", src_path);
+        return -1;
+    }
+
+    // Link into the new parent first, so a failure leaves the entry where it was
+    src_parent = (struct heartyfs_directory *)heartyfs_block(buffer, src_parent_id);
+    unsigned short info = src_parent->entry_info[src_index];
+    dst_parent = (struct heartyfs_directory *)heartyfs_block(buffer, dst_parent_id);
+    if (dst_parent_id == src_parent_id) {
+        // A rename within one directory, the entry keeps its slot
+        for (int i = 0; i < dst_parent->size; i++) {
+            if (i != src_index && strcmp(dst_parent->entries[i].file_name, name) == 0) {
+                fprintf(stderr, "Error: %s already exists\n", name);
+                return -1;
+            }
+        }
+        memset(dst_parent->entries[src_index].file_name, 0, FILENAME_MAXLEN);
+        strncpy(dst_parent->entries[src_index].file_name, name, FILENAME_MAXLEN - 1);
+    } else {
+        if (add_directory_entry(dst_parent, block_id, name, info) != 0) {
+            return -1;
+        }
+        src_parent = (struct heartyfs_directory *)heartyfs_block(buffer, src_parent_id);
+        remove_directory_entry(src_parent, src_index);
+    }
+
+    // The moved block carries its own name, and a directory its parent
+    struct heartyfs_directory *moved = (struct heartyfs_directory *)heartyfs_block(buffer, block_id);
+    memset(moved->name, 0, sizeof(moved->name));
+    strncpy(moved->name, name, sizeof(moved->name) - 1);
+    if (is_dir) {
+        moved->entries[1].block_id = dst_parent_id;
+    }
+
+    // The old name is gone from one directory and the new one appears in the other
+    stamp_generation(buffer, -1, src_parent_id);
+    if (is_dir) {
+        stamp_moved_directory(buffer, block_id, dst_parent_id);
+    } else {
+        stamp_generation(buffer, block_id, dst_parent_id);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    printf("heartyfs_mv\n");
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <src_path> <dst_path>\n", argv[0]);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    if (move_entry(buffer, argv[1], argv[2]) == 0) {
+        printf("Success: %s moved to %s successfully\n", argv[1], argv[2]);
+    } else {
+        fprintf(stderr, "Error: Failed to move %s to %s\n", argv[1], argv[2]);
+    }
+
+    heartyfs_sync(buffer);
+
+    heartyfs_unmount(buffer);
+
+    return 0;
+}
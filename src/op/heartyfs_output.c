@@ -0,0 +1,105 @@
+/**
+ * @file heartyfs_output.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file buffers what a tool streams to stdout, so a large archive or
+ * stream goes out in a few large writes instead of one write per header or block.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)  // Bytes handed to each write on stdout
+
+static char *out_buffer;
+static size_t out_length = 0;
+static long long out_total = 0;
+
+/**
+ * @brief Allocate the output buffer
+ *
+ * @return int - 0 if successful, -1 if failed
+ */
+int heartyfs_output_open(void) {
+    out_buffer = malloc(OUTPUT_BUFFER_SIZE);
+    if (out_buffer == NULL) {
+        fprintf(stderr, "Error: Failed to allocate the output buffer\n");
+        return -1;
+    }
+    out_length = 0;
+    out_total = 0;
+    return 0;
+}
+
+/**
+ * @brief Write the output buffer to stdout
+ *
+ * @return int - 0 if successful, -1 if failed
+ */
+int heartyfs_flush_output(void) {
+    size_t done = 0;
+    while (done < out_length) {
+        ssize_t bytes = write(STDOUT_FILENO, out_buffer + done, out_length - done);
+        if (bytes <= 0) {
+            perror("Error: Failed to write to stdout");
+            return -1;
+        }
+        done += bytes;
+    }
+    out_length = 0;
+    return 0;
+}
+
+/**
+ * @brief Append bytes to the output, writing the buffer out whenever it fills up
+ *
+ * @param data - The bytes, NULL for zeros
+ * @param length - The number of bytes
+ * @return int - 0 if successful, -1 if failed
+ */
+int heartyfs_emit(const void *data, size_t length) {
+    while (length > 0) {
+        size_t chunk = OUTPUT_BUFFER_SIZE - out_length;
+        if (chunk > length) {
+            chunk = length;
+        }
+        if (data != NULL) {
+            memcpy(out_buffer + out_length, data, chunk);
+            data = (const char *)data + chunk;
+        } else {
+            memset(out_buffer + out_length, 0, chunk);
+        }
+        out_length += chunk;
+        out_total += chunk;
+        length -= chunk;
+        if (out_length == OUTPUT_BUFFER_SIZE && heartyfs_flush_output() != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief The number of bytes appended since heartyfs_output_open
+ *
+ * @return long long - The number of bytes, flushed or not
+ */
+long long heartyfs_output_total(void) {
+    return out_total;
+}
+
+/**
+ * @brief Free the output buffer, dropping anything not flushed
+ */
+void heartyfs_output_close(void) {
+    free(out_buffer);
+    out_buffer = NULL;
+    out_length = 0;
+}
@@ -17,6 +17,37 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <libgen.h>
+#include <sys/uio.h>
+
+#define READ_IOV_MAX 1024   // IOV_MAX on Linux, a view has at most 2 * INODE_BLOCKS spans
+
+/**
+ * @brief Write a list of buffers to stdout, continuing after short writes to a pipe
+ * 
+ * @param iov - The buffers, advanced in place
+ * @param count - The number of buffers
+ * @param length - The total length
+ * @return int - 0 if successful, -1 if failed
+ */
+static int write_all(struct iovec *iov, int count, ssize_t length) {
+    while (length > 0) {
+        ssize_t written = writev(STDOUT_FILENO, iov, count);
+        if (written <= 0) {
+            return -1;
+        }
+        length -= written;
+        while (count > 0 && written >= (ssize_t)iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
 
 /**
  * @brief Read a file from the heartyfs file system
@@ -26,60 +57,47 @@
  * @return int - 0 if successful, -1 if failed
  */
 int read_file(void *buffer, const char *path) {
-    struct heartyfs_inode *inode;
-    int inode_block_id = find_inode_by_path(buffer, path, &inode);
-
-    if (inode_block_id == -1) {
-        fprintf(stderr, "Error: File %s does not exist\n", path);
+    struct heartyfs_view view;
+    if (heartyfs_view_open(buffer, path, &view) != 0) {
         return -1;
     }
 
-    if (inode->type != 0) {
-        fprintf(stderr, "Error: %s is not a regular file\n", path);
-        return -1;
-    }
-
-    int remaining = inode->size;
-    int block_index = 0;
-
-    while (remaining > 0 && block_index < INODE_BLOCKS) {
-        int block_id = inode->data_blocks[block_index];
-        if (block_id == -1) {
-            break;
+    // The spans point into the image, so the file goes out with no copy in between
+    heartyfs_phase_begin(HEARTYFS_PHASE_COPY);
+    int result = 0;
+    for (int first = 0; first < view.count && result == 0; first += READ_IOV_MAX) {
+        int count = (view.count - first < READ_IOV_MAX) ? view.count - first : READ_IOV_MAX;
+        struct iovec iov[READ_IOV_MAX];
+        ssize_t expected = 0;
+        for (int i = 0; i < count; i++) {
+            iov[i].iov_base = (void *)view.spans[first + i].data;
+            iov[i].iov_len = view.spans[first + i].length;
+            expected += iov[i].iov_len;
         }
-
-        struct heartyfs_data_block *data_block = (struct heartyfs_data_block *)((char *)buffer + block_id * BLOCK_SIZE);
-        int to_read = (remaining > data_block->size) ? data_block->size : remaining;
-
-        if (write(STDOUT_FILENO, data_block->name, to_read) != to_read) {
+        if (write_all(iov, count, expected) != 0) {
             perror("Error: Failed to write to stdout");
-            return -1;
+            result = -1;
         }
-
-        remaining -= to_read;
-        block_index++;
     }
+    heartyfs_phase_end();
 
-    return 0;
+    if (result == 0) {
+        heartyfs_trace_bytes(view.size);
+    }
+    heartyfs_view_close(&view);
+    return result;
 }
 
 int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
     printf("heartyfs_read\n");
     if (argc != 2) {
         fprintf(stderr, "Usage: %s <file_path>\n", argv[0]);
         return 1;
     }
 
-    int fd = open(DISK_FILE_PATH, O_RDONLY);
-    if (fd < 0) {
-        perror("Error: Cannot open the disk file");
-        return 1;
-    }
-
-    void *buffer = mmap(NULL, DISK_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("Error: Cannot map the disk file onto memory");
-        close(fd);
+    void *buffer = heartyfs_mount(HEARTYFS_RDONLY);
+    if (buffer == NULL) {
         return 1;
     }
 
@@ -87,10 +105,7 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error: Failed to read file %s\n", argv[1]);
     }
 
-    if (munmap(buffer, DISK_SIZE) == -1) {
-        perror("Error: Failed to unmap file");
-    }
-    close(fd);
+    heartyfs_unmount(buffer);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+/**
+ * @file heartyfs_readmany.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file reads many files from the heartyfs file system in one run and
+ * writes them to stdout as one framed stream, in the order they were asked for.
+ * Every file is framed by a header line followed by its content:
+ *
+ *   <size> <path>\n<size bytes>
+ *
+ * A file that does not exist gets the size -1 and a corrupted file -2, with no content.
+ * The paths are given as arguments, or one per line on stdin when there are none.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Read the paths from stdin, one per line
+ *
+ * @param count - Set to the number of paths
+ * @return char** - The paths
+ */
+char **read_paths(int *count) {
+    char **paths = NULL;
+    int capacity = 0;
+    *count = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, stdin)) != -1) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = (capacity == 0) ? 256 : capacity * 2;
+            paths = realloc(paths, capacity * sizeof(char *));
+        }
+        paths[(*count)++] = strdup(line);
+    }
+    free(line);
+    return paths;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    int count = argc - 1;
+    char **paths = argv + 1;
+    if (count == 0) {
+        paths = read_paths(&count);
+    }
+    if (count == 0) {
+        fprintf(stderr, "Usage: %s <file_path>... (or one path per line on stdin)\n", argv[0]);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDONLY);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    struct heartyfs_batch_file *files = calloc(count, sizeof(struct heartyfs_batch_file));
+    for (int i = 0; i < count; i++) {
+        files[i].path = paths[i];
+    }
+    int read = heartyfs_read_batch(buffer, files, count);
+
+    long long total = 0;
+    int result = heartyfs_output_open();
+    for (int i = 0; i < count && result == 0; i++) {
+        char header[HEARTYFS_PATH_MAX + 32];
+        int size = files[i].size;
+        if (files[i].status == HEARTYFS_BATCH_MISSING) {
+            fprintf(stderr, "Error: %s does not exist or is not a regular file\n", files[i].path);
+            size = -1;
+        } else if (files[i].status == HEARTYFS_BATCH_CORRUPTED) {
+            fprintf(stderr, "Error: %s is corrupted (checksum mismatch)\n", files[i].path);
+            size = -2;
+        }
+        int length = snprintf(header, sizeof(header), "%d %s\n", size, files[i].path);
+        result = heartyfs_emit(header, length);
+        if (result == 0 && size > 0) {
+            result = heartyfs_emit(files[i].data, size);
+            total += size;
+        }
+    }
+    if (result == 0) {
+        result = heartyfs_flush_output();
+    }
+    heartyfs_trace_bytes(total);
+    fprintf(stderr, "Read %d of %d files, %lld bytes\n", read, count, total);
+
+    heartyfs_batch_free(files, count);
+    free(files);
+    heartyfs_output_close();
+
+    heartyfs_unmount(buffer);
+
+    return (result == 0 && read == count) ? 0 : 1;
+}
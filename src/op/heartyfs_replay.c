@@ -0,0 +1,388 @@
+/**
+ * @file heartyfs_replay.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file replays a trace recorded with HEARTYFS_TRACE. Every recorded tool
+ * run is started again in the order the runs started, either back to back or at the
+ * original pacing, and the throughput and the latency of every tool are reported next
+ * to the latencies in the trace.
+ *
+ * Files written into heartyfs that no longer exist outside of it (e.g. a trace taken on
+ * another machine) are replaced by generated files of the recorded size.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define REPLAY_MAX_ARGS 64
+#define REPLAY_MAX_TOOLS 32
+
+// One recorded tool run
+struct replay_op {
+    long long start_us;
+    long long recorded_us;
+    int recorded_status;
+    long long bytes;
+    char *line;                     // Owns the strings argv points into
+    char *argv[REPLAY_MAX_ARGS + 1];
+    long long latency_us;           // Measured by the replay
+    int status;
+};
+
+// The latencies of one tool
+struct replay_tool {
+    const char *name;
+    int count;
+    long long *latencies;
+    long long recorded_total_us;
+};
+
+/**
+ * @brief Get the monotonic clock in microseconds
+ *
+ * @return long long - The time in microseconds
+ */
+static long long now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief Parse a trace log
+ *
+ * @param path - The trace log
+ * @param count - Set to the number of runs
+ * @return struct replay_op* - The runs, NULL if the trace cannot be read
+ */
+struct replay_op *read_trace(const char *path, int *count) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Error: Cannot open the trace");
+        return NULL;
+    }
+
+    struct replay_op *ops = NULL;
+    int capacity = 0;
+    *count = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    int line_number = 0;
+    while (getline(&line, &line_capacity, file) != -1) {
+        line_number++;
+        line[strcspn(line, "\n")] = '\0';
+        if (*count == capacity) {
+            capacity = (capacity == 0) ? 256 : capacity * 2;
+            ops = realloc(ops, capacity * sizeof(struct replay_op));
+        }
+        struct replay_op *op = &ops[*count];
+        memset(op, 0, sizeof(*op));
+        op->line = strdup(line);
+
+        // start_us duration_us status bytes tool arg...
+        char *fields[REPLAY_MAX_ARGS + 4];
+        int num_fields = 0;
+        for (char *field = strtok(op->line, "\t"); field != NULL && num_fields < REPLAY_MAX_ARGS + 4; field = strtok(NULL, "\t")) {
+            fields[num_fields++] = field;
+        }
+        if (num_fields < 5) {
+            fprintf(stderr, "Error: Line %d of the trace is malformed, skipped\n", line_number);
+            free(op->line);
+            continue;
+        }
+        op->start_us = atoll(fields[0]);
+        op->recorded_us = atoll(fields[1]);
+        op->recorded_status = atoi(fields[2]);
+        op->bytes = atoll(fields[3]);
+        for (int i = 4; i < num_fields; i++) {
+            op->argv[i - 4] = fields[i];
+        }
+        (*count)++;
+    }
+    free(line);
+    fclose(file);
+    return ops;
+}
+
+static int compare_start(const void *a, const void *b) {
+    const struct replay_op *x = a;
+    const struct replay_op *y = b;
+    return (x->start_us > y->start_us) - (x->start_us < y->start_us);
+}
+
+static int compare_latency(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Stand in for an external file that is gone: write a file of the recorded size
+ * with content that depends only on its position in the trace
+ *
+ * @param op - The heartyfs_write run
+ * @param index - Its position in the trace
+ * @return int - 0 if successful, -1 if failed
+ */
+int generate_input(struct replay_op *op, int index) {
+    int last = 0;
+    while (op->argv[last + 1] != NULL) {
+        last++;
+    }
+    struct stat st;
+    if (last == 0 || stat(op->argv[last], &st) == 0) {
+        return 0;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/heartyfs_replay.%d", index);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Error: Cannot create a replay input file");
+        return -1;
+    }
+    unsigned int seed = index * 2654435761u;
+    char chunk[DATA_BLOCK_NAME_SIZE];
+    for (long long done = 0; done < op->bytes; done += sizeof(chunk)) {
+        for (size_t i = 0; i < sizeof(chunk); i++) {
+            seed = seed * 1103515245u + 12345u;
+            chunk[i] = seed >> 24;
+        }
+        long long remaining = op->bytes - done;
+        size_t length = (remaining < (long long)sizeof(chunk)) ? (size_t)remaining : sizeof(chunk);
+        if (write(fd, chunk, length) != (ssize_t)length) {
+            perror("Error: Cannot write a replay input file");
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    op->argv[last] = strdup(path);
+    return 0;
+}
+
+/**
+ * @brief Run one recorded tool and wait for it
+ *
+ * @param op - The run, its latency and status are filled in
+ * @param bin_dir - The directory holding the tools
+ * @param verbose - 1 to let the tool print to the terminal
+ */
+void run_op(struct replay_op *op, const char *bin_dir, int verbose) {
+    char tool[HEARTYFS_PATH_MAX];
+    snprintf(tool, sizeof(tool), "%s/%s", bin_dir, op->argv[0]);
+
+    long long start = now_us();
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Archives are not recorded, so heartyfs_restore reads an empty one
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        if (!verbose) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execv(tool, op->argv);
+        perror("Error: Cannot run the tool");
+        _exit(127);
+    }
+    int status = 0;
+    if (pid == -1) {
+        perror("Error: fork failed");
+        status = -1;
+    } else {
+        waitpid(pid, &status, 0);
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    op->latency_us = now_us() - start;
+    op->status = status;
+}
+
+/**
+ * @brief Copy an image over the disk file
+ *
+ * @param image - The image to start the replay from
+ * @return int - 0 if successful, -1 if failed
+ */
+int copy_image(const char *image) {
+    int in = open(image, O_RDONLY);
+    if (in == -1) {
+        perror("Error: Cannot open the image");
+        return -1;
+    }
+    int out = open(DISK_FILE_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1) {
+        perror("Error: Cannot open the disk file");
+        close(in);
+        return -1;
+    }
+    char chunk[1 << 16];
+    ssize_t bytes;
+    int result = 0;
+    while ((bytes = read(in, chunk, sizeof(chunk))) > 0) {
+        if (write(out, chunk, bytes) != bytes) {
+            perror("Error: Cannot write the disk file");
+            result = -1;
+            break;
+        }
+    }
+    close(in);
+    close(out);
+    return result;
+}
+
+/**
+ * @brief Print one line of latency statistics
+ *
+ * @param name - The tool, or "all"
+ * @param latencies - The latencies, sorted in place
+ * @param count - The number of latencies
+ * @param recorded_total_us - The sum of the latencies in the trace
+ */
+void print_latencies(const char *name, long long *latencies, int count, long long recorded_total_us) {
+    qsort(latencies, count, sizeof(long long), compare_latency);
+    long long total = 0;
+    for (int i = 0; i < count; i++) {
+        total += latencies[i];
+    }
+    printf("%-20s %6d %10lld %10lld %10lld %10lld %10lld %10lld\n", name, count,
+           total / count, latencies[count / 2], latencies[(count * 95) / 100],
+           latencies[(count * 99) / 100], latencies[count - 1], recorded_total_us / count);
+}
+
+int main(int argc, char *argv[]) {
+    int paced = 0;
+    int verbose = 0;
+    const char *image = NULL;
+    const char *bin_dir = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "pvi:b:")) != -1) {
+        if (opt == 'p') {
+            paced = 1;
+        } else if (opt == 'v') {
+            verbose = 1;
+        } else if (opt == 'i') {
+            image = optarg;
+        } else if (opt == 'b') {
+            bin_dir = optarg;
+        } else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-p] [-v] [-i image] [-b bin_dir] <trace>\n", argv[0]);
+        return 1;
+    }
+
+    // The tools sit next to the replay unless told otherwise
+    char self[HEARTYFS_PATH_MAX];
+    snprintf(self, sizeof(self), "%s", argv[0]);
+    if (bin_dir == NULL) {
+        bin_dir = dirname(self);
+    }
+
+    int count;
+    struct replay_op *ops = read_trace(argv[optind], &count);
+    if (ops == NULL) {
+        return 1;
+    }
+    if (count == 0) {
+        fprintf(stderr, "Error: The trace is empty\n");
+        return 1;
+    }
+
+    // Runs are logged as they finish, replay them in the order they started
+    qsort(ops, count, sizeof(struct replay_op), compare_start);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(ops[i].argv[0], "heartyfs_write") == 0 && generate_input(&ops[i], i) != 0) {
+            return 1;
+        }
+    }
+    if (image != NULL && copy_image(image) != 0) {
+        return 1;
+    }
+    unsetenv("HEARTYFS_TRACE");   // The replayed runs must not extend the trace
+
+    long long replay_start = now_us();
+    long long total_bytes = 0;
+    int failed = 0;
+    int changed = 0;
+    int late = 0;
+    for (int i = 0; i < count; i++) {
+        struct replay_op *op = &ops[i];
+        if (paced) {
+            long long due = replay_start + (op->start_us - ops[0].start_us);
+            long long wait = due - now_us();
+            if (wait > 0) {
+                struct timespec delay = { wait / 1000000, (wait % 1000000) * 1000 };
+                nanosleep(&delay, NULL);
+            } else if (wait < -1000) {
+                late++;   // The previous run took longer than it did when recorded
+            }
+        }
+        run_op(op, bin_dir, verbose);
+        total_bytes += op->bytes;
+        failed += (op->status != 0);
+        changed += (op->status != op->recorded_status);
+    }
+    long long elapsed_us = now_us() - replay_start;
+
+    // Per tool latency, in the order each tool first appears
+    struct replay_tool tools[REPLAY_MAX_TOOLS];
+    int num_tools = 0;
+    long long *all = malloc(count * sizeof(long long));
+    long long recorded_total_us = 0;
+    for (int i = 0; i < count; i++) {
+        int t = 0;
+        while (t < num_tools && strcmp(tools[t].name, ops[i].argv[0]) != 0) {
+            t++;
+        }
+        if (t == num_tools && num_tools < REPLAY_MAX_TOOLS) {
+            tools[num_tools].name = ops[i].argv[0];
+            tools[num_tools].count = 0;
+            tools[num_tools].latencies = malloc(count * sizeof(long long));
+            tools[num_tools].recorded_total_us = 0;
+            num_tools++;
+        }
+        if (t < num_tools) {
+            tools[t].latencies[tools[t].count++] = ops[i].latency_us;
+            tools[t].recorded_total_us += ops[i].recorded_us;
+        }
+        all[i] = ops[i].latency_us;
+        recorded_total_us += ops[i].recorded_us;
+    }
+
+    double seconds = elapsed_us / 1e6;
+    printf("Replayed %d runs in %.3f s (%s): %.1f runs/s, %.2f MB/s\n", count, seconds,
+           paced ? "paced" : "fast", count / seconds, total_bytes / 1e6 / seconds);
+    printf("Failed: %d, exit status differs from the trace: %d", failed, changed);
+    if (paced) {
+        printf(", started late: %d", late);
+    }
+    printf("\n\n%-20s %6s %10s %10s %10s %10s %10s %10s\n", "latency (us)", "runs", "mean", "p50", "p95", "p99", "max", "traced");
+    for (int t = 0; t < num_tools; t++) {
+        print_latencies(tools[t].name, tools[t].latencies, tools[t].count, tools[t].recorded_total_us);
+        free(tools[t].latencies);
+    }
+    print_latencies("all", all, count, recorded_total_us);
+
+    free(all);
+    for (int i = 0; i < count; i++) {
+        free(ops[i].line);
+    }
+    free(ops);
+    return (changed == 0) ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file heartyfs_resize.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file grows a heartyfs image in place. An image made with heartyfs_init -n
+ * holds fewer blocks than NUM_BLOCK, the blocks past its end are kept marked used in
+ * the bitmap. Growing extends the backing files (the new space reads as zeros and is
+ * not written), then frees the new blocks in the bitmap and records the new size in
+ * the info, so nothing that is already stored moves or is rewritten. The block tables
+ * already cover NUM_BLOCK blocks and need no change.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Grow the image to a number of blocks
+ *
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param num_blocks - The new number of blocks, at most NUM_BLOCK
+ * @return int - The old number of blocks, -1 if failed
+ */
+int grow_image(unsigned char *bitmap, int num_blocks) {
+    struct heartyfs_info *info = get_info(bitmap);
+    if (info == NULL) {
+        fprintf(stderr, "Error: The image predates heartyfs_info and cannot be resized\n");
+        return -1;
+    }
+    int old_blocks = info->num_blocks;
+    if (num_blocks <= old_blocks) {
+        fprintf(stderr, "Error: The image already has %d blocks, it can only grow\n", old_blocks);
+        return -1;
+    }
+
+    // The space must exist before the bitmap hands it out
+    if (heartyfs_resize_backing(num_blocks) != 0) {
+        return -1;
+    }
+    set_block_range_free(bitmap, old_blocks, num_blocks - old_blocks);
+    info->num_blocks = num_blocks;
+    return old_blocks;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    printf("heartyfs_resize\n");
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <num_blocks>\n", argv[0]);
+        return 1;
+    }
+    char *end;
+    long num_blocks = strtol(argv[1], &end, 10);
+    if (*end != '\0' || num_blocks < 1 || num_blocks > NUM_BLOCK) {
+        fprintf(stderr, "Error: An image has at most %d blocks\n", NUM_BLOCK);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
+
+    int old_blocks = grow_image(bitmap, num_blocks);
+    if (old_blocks != -1) {
+        printf("Success: Image grown from %d to %ld blocks, %d blocks free\n", old_blocks, num_blocks, count_free_blocks(bitmap));
+    } else {
+        fprintf(stderr, "Error: Failed to resize the image\n");
+    }
+
+    heartyfs_sync(buffer);
+
+    heartyfs_unmount(buffer);
+
+    return 0;
+}
@@ -0,0 +1,472 @@
+/**
+ * @file heartyfs_restore.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file restores a tar (ustar) archive from stdin into a directory of the
+ * heartyfs file system, e.g. one written by heartyfs_export. The whole stream is read
+ * first so every block it needs is allocated up front as one contiguous run; each
+ * inode is followed by its data blocks, so restored files are laid out sequentially.
+ *
+ * Files that already exist are replaced. Incremental archives from heartyfs_export -i
+ * carry a GNU dumpdir for every changed directory: names of the directory missing from
+ * it are deleted, as `tar --incremental -x` does, so restoring a full export and then
+ * each incremental one in order rebuilds the tree.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#define RESTORE_READ_SIZE (1 << 20)  // Bytes asked from each read on stdin
+
+// One entry of the archive
+struct tar_entry {
+    char path[HEARTYFS_PATH_MAX];   // Relative to the target directory, no trailing '/'
+    int is_dir;
+    int size;
+    const char *data;
+    const char *listing;            // The dumpdir of a GNU 'D' entry, NULL otherwise
+};
+
+// Blocks handed out by the restore, from one run when the image has one
+struct block_cursor {
+    unsigned char *bitmap;
+    int next;       // Next block of the run, -1 to fall back to find_free_block_near
+    int end;
+    int goal;       // The last block handed out, fallback blocks are placed near it
+};
+
+/**
+ * @brief Read all of stdin
+ *
+ * @param length - Set to the number of bytes read
+ * @return char* - The bytes, NULL if reading failed
+ */
+char *read_stream(size_t *length) {
+    size_t capacity = RESTORE_READ_SIZE;
+    char *data = malloc(capacity);
+    *length = 0;
+    for (;;) {
+        if (capacity - *length < RESTORE_READ_SIZE) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+        ssize_t bytes = read(STDIN_FILENO, data + *length, RESTORE_READ_SIZE);
+        if (bytes < 0) {
+            perror("Error: Failed to read stdin");
+            free(data);
+            return NULL;
+        }
+        if (bytes == 0) {
+            return data;
+        }
+        *length += bytes;
+    }
+}
+
+/**
+ * @brief Parse an octal tar header field
+ *
+ * @param field - The field
+ * @param width - The width of the field
+ * @return long - The value
+ */
+long parse_octal(const char *field, int width) {
+    long value = 0;
+    for (int i = 0; i < width && field[i] != '\0' && field[i] != ' '; i++) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+/**
+ * @brief Split an archive into its directory and regular file entries
+ *
+ * @param data - The archive
+ * @param length - The size of the archive
+ * @param count - Set to the number of entries
+ * @return struct tar_entry* - The entries, NULL if the archive is malformed
+ */
+struct tar_entry *parse_archive(const char *data, size_t length, int *count) {
+    int capacity = 64;
+    struct tar_entry *entries = malloc(capacity * sizeof(struct tar_entry));
+    *count = 0;
+    size_t offset = 0;
+    char long_name[HEARTYFS_PATH_MAX] = "";
+    while (offset + BLOCK_SIZE <= length && data[offset] != '\0') {
+        const char *header = data + offset;
+        unsigned int checksum = 0;
+        for (int i = 0; i < BLOCK_SIZE; i++) {
+            checksum += (i >= 148 && i < 156) ? ' ' : (unsigned char)header[i];
+        }
+        long size = parse_octal(header + 124, 12);
+        if (checksum != parse_octal(header + 148, 8) || offset + BLOCK_SIZE + size > length) {
+            fprintf(stderr, "Error: Malformed tar header at byte %zu\n", offset);
+            free(entries);
+            return NULL;
+        }
+
+        char type = header[156];
+        if (type == 'L') {
+            // A GNU long name, it replaces the name of the next header
+            snprintf(long_name, sizeof(long_name), "%.*s", (int)size, header + BLOCK_SIZE);
+        } else if (type == '0' || type == '\0' || type == '5' || type == 'D') {
+            if (*count == capacity) {
+                capacity *= 2;
+                entries = realloc(entries, capacity * sizeof(struct tar_entry));
+            }
+            struct tar_entry *entry = &entries[*count];
+            if (long_name[0] != '\0') {
+                snprintf(entry->path, sizeof(entry->path), "%s", long_name);
+            } else if (header[345] != '\0' && memcmp(header + 257, "ustar  ", 8) != 0) {
+                snprintf(entry->path, sizeof(entry->path), "%.155s/%.100s", header + 345, header);
+            } else {
+                snprintf(entry->path, sizeof(entry->path), "%.100s", header);
+            }
+            size_t path_length = strlen(entry->path);
+            while (path_length > 0 && entry->path[path_length - 1] == '/') {
+                entry->path[--path_length] = '\0';
+            }
+            entry->is_dir = (type == '5' || type == 'D');
+            entry->size = entry->is_dir ? 0 : (int)size;
+            entry->data = header + BLOCK_SIZE;
+            entry->listing = (type == 'D' && size > 0 && header[BLOCK_SIZE + size - 1] == '\0') ? header + BLOCK_SIZE : NULL;
+            // The archive root only matters for the names its dumpdir deletes
+            if (path_length > 0 && (strcmp(entry->path, ".") != 0 || entry->listing != NULL)) {
+                (*count)++;
+            }
+        } else {
+            fprintf(stderr, "Warning: Skipping %.100s, only directories and regular files are restored\n", header);
+        }
+        if (type != 'L') {
+            long_name[0] = '\0';
+        }
+        offset += BLOCK_SIZE + (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    }
+    return entries;
+}
+
+/**
+ * @brief Check whether a chunk of a file is all zeros, such chunks are restored as holes
+ *
+ * @param data - The chunk
+ * @param length - The size of the chunk
+ * @return int - 1 if every byte is zero
+ */
+int is_zero_chunk(const char *data, int length) {
+    for (int i = 0; i < length; i++) {
+        if (data[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Count the blocks a restore needs at most (dedup may share some data blocks)
+ *
+ * @param entries - The archive entries
+ * @param count - The number of entries
+ * @return int - The number of blocks
+ */
+int count_restore_blocks(struct tar_entry *entries, int count) {
+    int blocks = 0;
+    for (int i = 0; i < count; i++) {
+        blocks += (strcmp(entries[i].path, ".") != 0);
+        for (int offset = 0; offset < entries[i].size; offset += DATA_BLOCK_NAME_SIZE) {
+            int chunk = (entries[i].size - offset > DATA_BLOCK_NAME_SIZE) ? DATA_BLOCK_NAME_SIZE : entries[i].size - offset;
+            if (!is_zero_chunk(entries[i].data + offset, chunk)) {
+                blocks++;
+            }
+        }
+    }
+    return blocks;
+}
+
+/**
+ * @brief Take the next block of the restore and mark it used
+ *
+ * @param cursor - The block cursor
+ * @return int - The block number, -1 if no free block is found
+ */
+int next_block(struct block_cursor *cursor) {
+    int block_id = (cursor->next != -1 && cursor->next < cursor->end) ? cursor->next++ : find_free_block_near(cursor->bitmap, cursor->goal);
+    if (block_id != -1) {
+        set_block_used(cursor->bitmap, block_id);
+        cursor->goal = block_id;
+    }
+    return block_id;
+}
+
+/**
+ * @brief Free a file, or a directory with everything below it
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param block_id - The inode or directory
+ */
+void remove_tree(void *buffer, unsigned char *bitmap, int block_id) {
+    struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(buffer, block_id);
+    if (dir->type == 1) {
+        for (int i = 2; i < dir->size; i++) {
+            remove_tree(buffer, bitmap, dir->entries[i].block_id);
+            dir = (struct heartyfs_directory *)heartyfs_block(buffer, block_id);
+        }
+    } else {
+        release_inode_blocks(buffer, bitmap, (struct heartyfs_inode *)dir);
+    }
+    set_block_free(bitmap, block_id);
+    heartyfs_clear_blocks(buffer, block_id, 1);
+}
+
+/**
+ * @brief Remove an entry from a directory, with everything below it
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param dir_block_id - The directory
+ * @param index - The index of the entry
+ */
+void remove_entry(void *buffer, unsigned char *bitmap, int dir_block_id, int index) {
+    struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(buffer, dir_block_id);
+    remove_tree(buffer, bitmap, dir->entries[index].block_id);
+    dir = (struct heartyfs_directory *)heartyfs_block(buffer, dir_block_id);
+    remove_directory_entry(dir, index);
+    stamp_generation(buffer, -1, dir_block_id);
+}
+
+/**
+ * @brief Delete the names of a directory that its dumpdir no longer lists, or lists
+ * as the other kind (a directory where a file was or the other way around)
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param dir_path - The directory
+ * @param listing - The dumpdir: names prefixed with 'D', 'Y' or 'N', each ending with a
+ * NUL, and an empty name at the end
+ * @return int - The number of names deleted
+ */
+int apply_dumpdir(void *buffer, unsigned char *bitmap, const char *dir_path, const char *listing) {
+    struct heartyfs_directory *dir;
+    int dir_block_id = find_directory_by_path(buffer, dir_path, &dir);
+    if (dir_block_id == -1) {
+        return 0;
+    }
+    int deleted = 0;
+    int i = 2;
+    while (i < dir->size) {
+        int is_dir = entry_info_of(heartyfs_block(buffer, dir->entries[i].block_id)) == ENTRY_INFO_DIRECTORY;
+        int listed = 0;
+        for (const char *name = listing; *name != '\0'; name += strlen(name) + 1) {
+            if (strcmp(name + 1, dir->entries[i].file_name) == 0) {
+                listed = ((name[0] == 'D') == is_dir);
+                break;
+            }
+        }
+        if (listed) {
+            i++;
+            continue;
+        }
+        remove_entry(buffer, bitmap, dir_block_id, i);
+        dir = (struct heartyfs_directory *)heartyfs_block(buffer, dir_block_id);
+        deleted++;
+    }
+    return deleted;
+}
+
+/**
+ * @brief Restore one directory or file into its parent
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param cursor - The block cursor
+ * @param target - The directory the archive is restored into
+ * @param entry - The archive entry
+ * @return int - 0 if successful, -1 if failed
+ */
+int restore_entry(void *buffer, struct block_cursor *cursor, const char *target, struct tar_entry *entry) {
+    char full_path[HEARTYFS_PATH_MAX * 2];
+    snprintf(full_path, sizeof(full_path), "%s/%s", (strcmp(target, "/") == 0) ? "" : target, entry->path);
+    if (strcmp(entry->path, ".") == 0) {
+        snprintf(full_path, sizeof(full_path), "%s", target);  // The dumpdir of the target itself
+    }
+    char *path_copy = strdup(full_path);
+    char *parent_copy = strdup(full_path);
+    char *name = basename(path_copy);
+    char *parent_path = dirname(parent_copy);
+
+    struct heartyfs_directory *parent_dir;
+    int parent_block_id = find_directory_by_path(buffer, parent_path, &parent_dir);
+    int result = -1;
+    int existing = -1;
+    for (int i = 0; parent_block_id != -1 && parent_dir->type == 1 && i < parent_dir->size; i++) {
+        if (strcmp(parent_dir->entries[i].file_name, name) == 0) {
+            existing = i;
+        }
+    }
+    if (parent_block_id == -1 || parent_dir->type != 1) {
+        fprintf(stderr, "Error: Parent directory %s does not exist\n", parent_path);
+    } else if (strlen(name) >= FILENAME_MAXLEN) {
+        fprintf(stderr, "Error: Name %s is longer than %d bytes\n", name, FILENAME_MAXLEN - 1);
+    } else if (entry->is_dir && (strcmp(entry->path, ".") == 0 || (existing != -1
+               && entry_info_of(heartyfs_block(buffer, parent_dir->entries[existing].block_id)) == ENTRY_INFO_DIRECTORY))) {
+        result = 0;  // Restoring into an existing tree
+    } else if (existing != -1 && (entry->is_dir
+               || entry_info_of(heartyfs_block(buffer, parent_dir->entries[existing].block_id)) == ENTRY_INFO_DIRECTORY)) {
+        fprintf(stderr, "Error: %s already exists\n", full_path);
+    } else if (entry->size > INODE_BLOCKS * DATA_BLOCK_NAME_SIZE) {
+        fprintf(stderr, "Error: %s is larger than a heartyfs file\n", full_path);
+    } else if (existing == -1 && parent_dir->size >= DIR_MAX_ENTRIES) {
+        fprintf(stderr, "Error: Directory %s is full\n", parent_path);
+    } else {
+        if (existing != -1) {
+            // A file in the archive replaces the one already there
+            remove_entry(buffer, cursor->bitmap, parent_block_id, existing);
+        }
+        int block_id = next_block(cursor);
+        struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, block_id);
+        memset(inode, 0, BLOCK_SIZE);
+        strncpy(inode->name, name, FILENAME_MAXLEN - 1);
+
+        if (entry->is_dir) {
+            struct heartyfs_directory *dir = (struct heartyfs_directory *)inode;
+            dir->type = 1;
+            dir->size = 2;
+            dir->entries[0].block_id = block_id;
+            strcpy(dir->entries[0].file_name, ".");
+            dir->entries[1].block_id = parent_block_id;
+            strcpy(dir->entries[1].file_name, "..");
+            dir->entry_info[0] = ENTRY_INFO_DIRECTORY;
+            dir->entry_info[1] = ENTRY_INFO_DIRECTORY;
+        } else {
+            // The data blocks follow the inode, zero chunks stay holes
+            inode->type = 0;
+            inode->size = entry->size;
+            memset(inode->data_blocks, -1, sizeof(inode->data_blocks));
+            struct heartyfs_data_block data_block;
+            for (int i = 0; i * DATA_BLOCK_NAME_SIZE < entry->size; i++) {
+                int chunk = (entry->size - i * DATA_BLOCK_NAME_SIZE > DATA_BLOCK_NAME_SIZE) ? DATA_BLOCK_NAME_SIZE : entry->size - i * DATA_BLOCK_NAME_SIZE;
+                const char *chunk_data = entry->data + i * DATA_BLOCK_NAME_SIZE;
+                int data_block_id = HOLE_BLOCK;
+                if (!is_zero_chunk(chunk_data, chunk)) {
+                    memset(&data_block, 0, sizeof(data_block));
+                    data_block.size = chunk;
+                    memcpy(data_block.name, chunk_data, chunk);
+                    data_block_id = share_identical_block(buffer, cursor->bitmap, &data_block);
+                    if (data_block_id == -1) {
+                        data_block_id = next_block(cursor);
+                        place_data_block(buffer, cursor->bitmap, data_block_id, &data_block);
+                    }
+                }
+                inode = (struct heartyfs_inode *)heartyfs_block(buffer, block_id);
+                inode->data_blocks[i] = data_block_id;
+            }
+        }
+
+        inode = (struct heartyfs_inode *)heartyfs_block(buffer, block_id);
+        parent_dir = (struct heartyfs_directory *)heartyfs_block(buffer, parent_block_id);
+        result = add_directory_entry(parent_dir, block_id, name, entry_info_of(inode));
+        stamp_generation(buffer, block_id, parent_block_id);
+    }
+
+    free(path_copy);
+    free(parent_copy);
+    return result;
+}
+
+/**
+ * @brief Restore an archive into a directory
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param target - The directory to restore into
+ * @return int - 0 if successful, -1 if any entry failed
+ */
+int restore_archive(void *buffer, unsigned char *bitmap, const char *target) {
+    size_t length;
+    char *data = read_stream(&length);
+    if (data == NULL) {
+        return -1;
+    }
+    heartyfs_trace_bytes(length);
+    int count;
+    struct tar_entry *entries = parse_archive(data, length, &count);
+    if (entries == NULL) {
+        free(data);
+        return -1;
+    }
+
+    struct heartyfs_directory *target_dir;
+    int needed = count_restore_blocks(entries, count);
+    int result = 0;
+    int target_block_id = find_directory_by_path(buffer, target, &target_dir);
+    if (target_block_id == -1 || target_dir->type != 1) {
+        fprintf(stderr, "Error: Directory %s does not exist\n", target);
+        result = -1;
+    } else if (needed > count_free_blocks(bitmap)) {
+        fprintf(stderr, "Error: The archive needs %d blocks, only %d are free\n", needed, count_free_blocks(bitmap));
+        result = -1;
+    }
+
+    // Bulk allocation: one run for everything when the image has one, near the target
+    struct block_cursor cursor = { bitmap, find_free_run_near(bitmap, needed, target_block_id), 0, target_block_id };
+    cursor.end = cursor.next + needed;
+    int restored = 0;
+    int deleted = 0;
+    for (int i = 0; i < count && result == 0; i++) {
+        if (restore_entry(buffer, &cursor, target, &entries[i]) == 0) {
+            restored++;
+        }
+        if (entries[i].listing != NULL) {
+            char dir_path[HEARTYFS_PATH_MAX * 2];
+            snprintf(dir_path, sizeof(dir_path), "%s/%s", (strcmp(target, "/") == 0) ? "" : target, entries[i].path);
+            deleted += apply_dumpdir(buffer, bitmap, (strcmp(entries[i].path, ".") == 0) ? target : dir_path, entries[i].listing);
+        }
+    }
+    if (restored < count) {
+        result = -1;
+    } else {
+        printf("Restored %d entries into %s (%s)\n", restored, target,
+               (cursor.next != -1) ? "one contiguous run" : "free space is fragmented");
+        if (deleted > 0) {
+            printf("Deleted %d entries missing from the archive's dumpdirs\n", deleted);
+        }
+    }
+
+    free(entries);
+    free(data);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    printf("heartyfs_restore\n");
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [directory_path] < archive.tar\n", argv[0]);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
+    const char *target = (argc == 2) ? argv[1] : "/";
+
+    if (restore_archive(buffer, bitmap, target) != 0) {
+        fprintf(stderr, "Error: Failed to restore into %s\n", target);
+    }
+
+    heartyfs_sync(buffer);
+
+    heartyfs_unmount(buffer);
+
+    return 0;
+}
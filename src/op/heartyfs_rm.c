@@ -36,54 +36,43 @@ int remove_file(void *buffer, unsigned char *bitmap, const char *path) {
         return -1;
     }
 
-    struct heartyfs_inode *inode = (struct heartyfs_inode *)((char *)buffer + inode_block_id * BLOCK_SIZE);
+    struct heartyfs_inode *inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
 
     if (inode->type != 0) {
         fprintf(stderr, "Error: %s is not a regular file\n", path);
         return -1;
     }
 
-    // Free data blocks
-    for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
-        set_block_free(bitmap, inode->data_blocks[i]);
-    }
+    // Release data blocks, shared blocks stay until their last reference is gone
+    release_inode_blocks(buffer, bitmap, inode);
 
     // Free inode block
     set_block_free(bitmap, inode_block_id);
 
     // Remove file entry from parent directory
-    for (int i = file_index; i < parent_dir->size - 1; i++) {
-        parent_dir->entries[i] = parent_dir->entries[i + 1];
-    }
-    parent_dir->size--;
+    remove_directory_entry(parent_dir, file_index);
+    stamp_generation(buffer, -1, parent_dir->entries[0].block_id);
 
     // Clear the inode block
-    memset(inode, 0, BLOCK_SIZE);
+    heartyfs_clear_blocks(buffer, inode_block_id, 1);
 
     return 0;
 }
 
 int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
     printf("heartyfs_rm\n");
     if (argc != 2) {
         fprintf(stderr, "Usage: %s <file_path>\n", argv[0]);
         return 1;
     }
 
-    int fd = open(DISK_FILE_PATH, O_RDWR);
-    if (fd < 0) {
-        perror("Error: Cannot open the disk file");
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
         return 1;
     }
 
-    void *buffer = mmap(NULL, DISK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("Error: Cannot map the disk file onto memory");
-        close(fd);
-        return 1;
-    }
-
-    unsigned char *bitmap = (unsigned char *)buffer + BLOCK_SIZE;
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
 
     if (remove_file(buffer, bitmap, argv[1]) == 0) {
         printf("Success: File %s removed successfully\n", argv[1]);
@@ -91,14 +80,9 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error: Failed to remove file %s\n", argv[1]);
     }
 
-    if (msync(buffer, DISK_SIZE, MS_SYNC) == -1) {
-        perror("Error: Failed to sync changes to disk");
-    }
+    heartyfs_sync(buffer);
 
-    if (munmap(buffer, DISK_SIZE) == -1) {
-        perror("Error: Failed to unmap file");
-    }
-    close(fd);
+    heartyfs_unmount(buffer);
 
     return 0;
 }
\ No newline at end of file
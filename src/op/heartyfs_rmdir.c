@@ -17,6 +17,17 @@
 #include <errno.h>
 #include <libgen.h>
 #include <stdlib.h>
+#include <pthread.h>
+
+// A worker collecting the blocks of the subtrees under one directory's entries
+struct collect_worker {
+    pthread_t thread;
+    void *buffer;
+    int dir_block_id;                   // The directory whose entries are shared between workers
+    int *next_entry;                    // Next entry of dir to walk, shared by all workers
+    struct heartyfs_block_list metadata; // Directory and inode blocks
+    struct heartyfs_block_list data;     // Data block references
+};
 
 /**
  * @brief Find a directory by its path
@@ -33,7 +44,7 @@
         char *parent_path = dirname(strdup(path_copy));
         char *dir_name = basename(path_copy);
 
-        struct heartyfs_directory *current = buffer; // Start at the root
+        struct heartyfs_directory *current = heartyfs_block(buffer, 0); // Start at the root
         int current_block_id = 0; // Start at the root block
         int found_index = -1; // The block ID of the directory
 
@@ -44,7 +55,7 @@
             for (int i = 0; i < current->size; i++) {
                 if (strcmp(current->entries[i].file_name, token) == 0) {
                     current_block_id = current->entries[i].block_id;
-                    current = (struct heartyfs_directory *)((char *)buffer + current_block_id * BLOCK_SIZE);
+                    current = (struct heartyfs_directory *)heartyfs_block(buffer, current_block_id);
                     found = 1; // Found the directory
                     break;
                 }
@@ -59,7 +70,7 @@
         // Find the directory in the parent directory
         for (int i = 0; i < current->size; i++) {
             if (strcmp(current->entries[i].file_name, dir_name) == 0) {
-                *dir = (struct heartyfs_directory *)((char *)buffer + current->entries[i].block_id * BLOCK_SIZE);
+                *dir = (struct heartyfs_directory *)heartyfs_block(buffer, current->entries[i].block_id);
                 *parent_dir = current;
                 *dir_index = i;
                 found_index = current->entries[i].block_id;
@@ -102,56 +113,183 @@ int remove_directory(void *buffer, unsigned char *bitmap, const char *path) {
     }
 
     // Remove the directory entry from its parent
-    for (int i = dir_index; i < parent_dir->size - 1; i++) {
-        parent_dir->entries[i] = parent_dir->entries[i + 1];
-    }
-    parent_dir->size--;
+    remove_directory_entry(parent_dir, dir_index);
+    stamp_generation(buffer, -1, parent_dir->entries[0].block_id);
 
     // Mark the block as free in the bitmap
     set_block_free(bitmap, dir_block_id);
 
     // Clear the directory block
-    memset(dir, 0, BLOCK_SIZE);
+    heartyfs_clear_blocks(buffer, dir_block_id, 1);
 
     return 0;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <directory_path>\n", argv[0]);
-        return 1;
+/**
+ * @brief Collect every block of a subtree without changing anything
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param block_id - The block number of the subtree root (directory or inode)
+ * @param metadata - The list receiving directory and inode blocks
+ * @param data - The list receiving data block references
+ */
+void collect_subtree(void *buffer, int block_id, struct heartyfs_block_list *metadata, struct heartyfs_block_list *data) {
+    struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(buffer, block_id);
+    block_list_add(metadata, block_id);
+
+    if (dir->type == 1) {
+        for (int i = 2; i < dir->size; i++) {
+            collect_subtree(buffer, dir->entries[i].block_id, metadata, data);
+            // The recursion may have evicted this directory from the block cache
+            dir = (struct heartyfs_directory *)heartyfs_block(buffer, block_id);
+        }
+        return;
     }
 
-    int fd = open(DISK_FILE_PATH, O_RDWR);
-    if (fd < 0) {
-        perror("Error: Cannot open the disk file");
+    struct heartyfs_inode *inode = (struct heartyfs_inode *)dir;
+    for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+        if (inode->data_blocks[i] != HOLE_BLOCK) {
+            block_list_add(data, inode->data_blocks[i]);
+        }
+    }
+}
+
+/**
+ * @brief Worker thread: take the next entry of the shared directory and collect its subtree
+ * 
+ * @param arg - The collect_worker of this thread
+ * @return void* - NULL
+ */
+void *collect_worker_main(void *arg) {
+    struct collect_worker *worker = arg;
+    struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(worker->buffer, worker->dir_block_id);
+    int i;
+    while ((i = __atomic_fetch_add(worker->next_entry, 1, __ATOMIC_RELAXED)) < dir->size) {
+        collect_subtree(worker->buffer, dir->entries[i].block_id, &worker->metadata, &worker->data);
+        dir = (struct heartyfs_directory *)heartyfs_block(worker->buffer, worker->dir_block_id);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Remove a directory and everything below it. The subtree is walked once
+ * (split over worker threads by top-level entry), then all freed blocks are
+ * released to the bitmap in sorted ranges.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param path - The path of the directory to remove
+ * @param num_threads - The number of worker threads walking the subtree
+ * @return int - 0 if successful, -1 if failed
+ */
+int remove_directory_recursive(void *buffer, unsigned char *bitmap, const char *path, int num_threads) {
+    struct heartyfs_directory *dir;
+    struct heartyfs_directory *parent_dir;
+    int dir_index;
+    int dir_block_id = find_directory(buffer, path, &dir, &parent_dir, &dir_index);
+
+    if (dir_block_id == -1) {
+        fprintf(stderr, "Error: Directory %s does not exist\n", path);
+        return -1;
+    }
+
+    if (dir->type != 1 || dir_block_id == 0) {
+        fprintf(stderr, "Error: %s is not a removable directory\n", path);
+        return -1;
+    }
+
+    // Cached block pointers are only stable on the flat mapping, walk on one thread otherwise
+    if (!heartyfs_flat_mapping()) {
+        num_threads = 1;
+    }
+    if (num_threads > dir->size - 2) {
+        num_threads = (dir->size > 2) ? dir->size - 2 : 1;
+    }
+    struct collect_worker *workers = calloc(num_threads, sizeof(struct collect_worker));
+    int next_entry = 2;
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].buffer = buffer;
+        workers[t].dir_block_id = dir_block_id;
+        workers[t].next_entry = &next_entry;
+        if (t > 0) {
+            pthread_create(&workers[t].thread, NULL, collect_worker_main, &workers[t]);
+        }
+    }
+    collect_worker_main(&workers[0]);
+
+    // Dropping references happens on this thread only, shared blocks may appear in several lists
+    struct heartyfs_block_list to_free = {0};
+    block_list_add(&to_free, dir_block_id);
+    for (int t = 0; t < num_threads; t++) {
+        if (t > 0) {
+            pthread_join(workers[t].thread, NULL);
+        }
+        for (int i = 0; i < workers[t].metadata.count; i++) {
+            block_list_add(&to_free, workers[t].metadata.blocks[i]);
+        }
+        for (int i = 0; i < workers[t].data.count; i++) {
+            if (IS_FRAGMENT(workers[t].data.blocks[i])) {
+                release_data_block(buffer, bitmap, workers[t].data.blocks[i]);
+            } else if (drop_block_ref(buffer, workers[t].data.blocks[i])) {
+                block_list_add(&to_free, workers[t].data.blocks[i]);
+            }
+        }
+        free(workers[t].metadata.blocks);
+        free(workers[t].data.blocks);
+    }
+    free(workers);
+
+    // Remove the directory entry from its parent
+    dir = (struct heartyfs_directory *)heartyfs_block(buffer, dir_block_id);
+    parent_dir = (struct heartyfs_directory *)heartyfs_block(buffer, dir->entries[1].block_id);
+    remove_directory_entry(parent_dir, dir_index);
+    stamp_generation(buffer, -1, parent_dir->entries[0].block_id);
+
+    int ranges = free_block_list(buffer, bitmap, &to_free);
+    printf("Freed %d blocks in %d ranges\n", to_free.count, ranges);
+    free(to_free.blocks);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    int recursive = 0;
+    int num_threads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "rj:")) != -1) {
+        if (opt == 'r') {
+            recursive = 1;
+        } else if (opt == 'j' && atoi(optarg) > 0) {
+            num_threads = atoi(optarg);
+        } else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-r [-j threads]] <directory_path>\n", argv[0]);
         return 1;
     }
+    char *path = argv[optind];
 
-    void *buffer = mmap(NULL, DISK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("Error: Cannot map the disk file onto memory");
-        close(fd);
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
         return 1;
     }
     // Start at the root
-    unsigned char *bitmap = (unsigned char *)buffer + BLOCK_SIZE;
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
     
-    // Check if heartyfs is initialized
-    if (remove_directory(buffer, bitmap, argv[1]) == 0) {
-        printf("Success: Directory %s removed successfully\n", argv[1]);
+    int result = recursive ? remove_directory_recursive(buffer, bitmap, path, num_threads)
+                           : remove_directory(buffer, bitmap, path);
+    if (result == 0) {
+        printf("Success: Directory %s removed successfully\n", path);
     } else {
-        fprintf(stderr, "Error: Failed to remove directory %s\n", argv[1]);
+        fprintf(stderr, "Error: Failed to remove directory %s\n", path);
     }
     // Sync changes to disk
-    if (msync(buffer, DISK_SIZE, MS_SYNC) == -1) {
-        perror("Error: Failed to sync changes to disk");
-    }
+    heartyfs_sync(buffer);
     // Unmap the file and close
-    if (munmap(buffer, DISK_SIZE) == -1) {
-        perror("Error: Failed to unmap file");
-    }
-    close(fd);
+    heartyfs_unmount(buffer);
 
     return 0;
 }
\ No newline at end of file
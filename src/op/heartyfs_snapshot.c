@@ -0,0 +1,209 @@
+/**
+ * @file heartyfs_snapshot.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file snapshots a directory subtree in the heartyfs file system.
+ * Directories and inodes are copied, data blocks are shared copy-on-write.
+ * @version 0.1
+ * @date 2024-10-03
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <libgen.h>
+
+/**
+ * @brief Count the blocks a snapshot of a subtree may allocate: its directory and
+ * inode blocks, plus one per packed tail since clones copy those
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param dir_block_id - The block number of the subtree root
+ * @return int - The number of blocks the snapshot may need
+ */
+int count_subtree_blocks(void *buffer, int dir_block_id) {
+    struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(buffer, dir_block_id);
+    int count = 1;
+    for (int i = 2; i < dir->size; i++) {
+        int entry_block_id = dir->entries[i].block_id;
+        struct heartyfs_directory *entry = (struct heartyfs_directory *)heartyfs_block(buffer, entry_block_id);
+        if (entry->type == 1) {
+            count += count_subtree_blocks(buffer, entry_block_id);
+        } else {
+            struct heartyfs_inode *inode = (struct heartyfs_inode *)entry;
+            count++;
+            for (int j = 0; j < INODE_BLOCKS && inode->data_blocks[j] != -1; j++) {
+                if (IS_FRAGMENT(inode->data_blocks[j])) {
+                    count++;
+                }
+            }
+        }
+        // The recursion may have evicted this directory from the block cache
+        dir = (struct heartyfs_directory *)heartyfs_block(buffer, dir_block_id);
+    }
+    return count;
+}
+
+/**
+ * @brief Release a partial clone, dropping the data block references it took
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param block_id - The block number of the cloned directory or inode
+ */
+void release_clone(void *buffer, unsigned char *bitmap, int block_id) {
+    struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(buffer, block_id);
+    if (dir->type == 1) {
+        for (int i = 2; i < dir->size; i++) {
+            release_clone(buffer, bitmap, dir->entries[i].block_id);
+            // The recursion may have evicted this directory from the block cache
+            dir = (struct heartyfs_directory *)heartyfs_block(buffer, block_id);
+        }
+    } else {
+        release_inode_blocks(buffer, bitmap, (struct heartyfs_inode *)dir);
+    }
+    heartyfs_clear_blocks(buffer, block_id, 1);
+    set_block_free(bitmap, block_id);
+}
+
+/**
+ * @brief Clone a directory subtree
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param src_block_id - The block number of the directory to clone
+ * @param parent_block_id - The block number of the directory receiving the clone
+ * @param name - The name of the clone
+ * @return int - The block number of the new directory, -1 if failed
+ */
+int clone_directory(void *buffer, unsigned char *bitmap, int src_block_id, int parent_block_id, const char *name) {
+    int block_id = find_free_block_near(bitmap, directory_goal(bitmap, parent_block_id));
+    if (block_id == -1) {
+        fprintf(stderr, "Error: No free blocks available\n");
+        return -1;
+    }
+    set_block_used(bitmap, block_id);
+
+    struct heartyfs_directory *src = (struct heartyfs_directory *)heartyfs_block(buffer, src_block_id);
+    struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(buffer, block_id);
+    memset(dir, 0, BLOCK_SIZE);
+    dir->type = 1;
+    strncpy(dir->name, name, sizeof(dir->name) - 1);
+    dir->size = 2;
+    dir->entries[0].block_id = block_id;
+    strcpy(dir->entries[0].file_name, ".");
+    dir->entries[1].block_id = parent_block_id;
+    strcpy(dir->entries[1].file_name, "..");
+    dir->entry_info[0] = ENTRY_INFO_DIRECTORY;
+    dir->entry_info[1] = ENTRY_INFO_DIRECTORY;
+
+    for (int i = 2; i < src->size; i++) {
+        int entry_block_id = src->entries[i].block_id;
+        struct heartyfs_directory *entry = (struct heartyfs_directory *)heartyfs_block(buffer, entry_block_id);
+        int clone_id;
+        if (entry->type == 1) {
+            clone_id = clone_directory(buffer, bitmap, entry_block_id, block_id, src->entries[i].file_name);
+        } else {
+            clone_id = clone_inode(buffer, bitmap, entry_block_id, src->entries[i].file_name, block_id);
+        }
+        if (clone_id == -1) {
+            release_clone(buffer, bitmap, block_id);
+            return -1;
+        }
+        // The recursion may have evicted both directories from the block cache
+        src = (struct heartyfs_directory *)heartyfs_block(buffer, src_block_id);
+        dir = (struct heartyfs_directory *)heartyfs_block(buffer, block_id);
+        add_directory_entry(dir, clone_id, src->entries[i].file_name, src->entry_info[i]);
+        stamp_generation(buffer, clone_id, block_id);
+    }
+    stamp_generation(buffer, block_id, parent_block_id);
+    return block_id;
+}
+
+/**
+ * @brief Snapshot a directory subtree to a new directory
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param src_path - The path of the directory to snapshot
+ * @param dst_path - The path of the snapshot, must not exist yet
+ * @return int - 0 if successful, -1 if failed
+ */
+int snapshot_directory(void *buffer, unsigned char *bitmap, const char *src_path, const char *dst_path) {
+    struct heartyfs_directory *src;
+    int src_block_id = find_directory_by_path(buffer, src_path, &src);
+    if (src_block_id == -1) {
+        fprintf(stderr, "Error: Directory %s does not exist\n", src_path);
+        return -1;
+    }
+
+    if (dst_path[0] != '/') {
+        fprintf(stderr, "Error: Snapshot path %s must be an absolute path\n", dst_path);
+        return -1;
+    }
+    char *path_copy = strdup(dst_path);
+    char *parent_copy = strdup(dst_path);
+    char *parent_path = dirname(parent_copy);
+    char *dir_name = basename(path_copy);
+
+    struct heartyfs_directory *parent_dir;
+    struct heartyfs_inode *existing;
+    int parent_block_id = find_directory_by_path(buffer, parent_path, &parent_dir);
+    int result = -1;
+    if (parent_block_id == -1) {
+        fprintf(stderr, "Error: Parent directory %s does not exist\n", parent_path);
+    } else if (find_inode_by_path(buffer, dst_path, &existing) != -1) {
+        fprintf(stderr, "Error: %s already exists\n", dst_path);
+    } else if (parent_dir->size >= DIR_MAX_ENTRIES) {
+        fprintf(stderr, "Error: Parent directory %s is full\n", parent_path);
+    } else if (create_ref_table(buffer, bitmap) != 0) {
+        // Error already reported
+    } else if (count_subtree_blocks(buffer, src_block_id) > count_free_blocks(bitmap)) {
+        fprintf(stderr, "Error: Not enough free blocks for the snapshot\n");
+    } else {
+        // The snapshot is linked into its parent last, so a snapshot inside src never sees itself
+        int block_id = clone_directory(buffer, bitmap, src_block_id, parent_block_id, dir_name);
+        parent_dir = (struct heartyfs_directory *)heartyfs_block(buffer, parent_block_id);
+        if (block_id != -1 && add_directory_entry(parent_dir, block_id, dir_name, ENTRY_INFO_DIRECTORY) == 0) {
+            result = 0;
+        }
+    }
+
+    free(path_copy);
+    free(parent_copy);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    printf("heartyfs_snapshot\n");
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <src_directory_path> <dst_directory_path>\n", argv[0]);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
+
+    if (snapshot_directory(buffer, bitmap, argv[1], argv[2]) == 0) {
+        printf("Success: Directory %s snapshotted to %s successfully\n", argv[1], argv[2]);
+    } else {
+        fprintf(stderr, "Error: Failed to snapshot directory %s to %s\n", argv[1], argv[2]);
+    }
+
+    heartyfs_sync(buffer);
+
+    heartyfs_unmount(buffer);
+
+    return 0;
+}
@@ -0,0 +1,259 @@
+/**
+ * @file heartyfs_trace.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file records every heartyfs tool run in a trace log when HEARTYFS_TRACE
+ * names a file. Each run appends one tab separated line:
+ *
+ *   start_us  duration_us  status  bytes  tool  arg...
+ *
+ * start_us is wall clock time in microseconds, duration_us is measured on the
+ * monotonic clock from the start of main to exit, bytes is the file data the tool read
+ * or wrote (0 when it moves no data). The line is appended with a single write so
+ * tools running side by side never interleave. heartyfs_replay runs a trace again.
+ *
+ * HEARTYFS_PHASES splits the time of a run into phases: mounting, path resolution,
+ * block allocation, data copy and sync, with the rest counted as other. A phase that
+ * starts inside another pauses it, so every microsecond is counted once. With
+ * HEARTYFS_PHASES=1 a summary is printed on stderr at exit, otherwise it names a log
+ * file that gets one tab separated line per run:
+ *
+ *   start_us  tool  mount_us  resolve_us  alloc_us  copy_us  sync_us  other_us
+ *
+ * When it is not set the hooks return after testing one flag.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <time.h>
+
+#define TRACE_LINE_MAX 4096
+#define PHASE_DEPTH 16
+#define PHASE_OTHER HEARTYFS_NUM_PHASES  // Time outside every phase
+
+static const char *phase_names[HEARTYFS_NUM_PHASES + 1] = { "mount", "resolve", "alloc", "copy", "sync", "other" };
+
+static struct {
+    int enabled;
+    long long start_us;
+    struct timespec started;
+    long long bytes;
+    char command[TRACE_LINE_MAX];   // "tool\targ\targ..."
+} trace;
+
+static struct {
+    int enabled;
+    const char *log;                // NULL to print the summary on stderr
+    long long start_us;
+    char tool[FILENAME_MAX];
+    int current;                    // The phase the clock is running for
+    int stack[PHASE_DEPTH];         // The phases paused by nested ones
+    int depth;
+    struct timespec mark;           // When the clock last switched phase
+    long long ns[HEARTYFS_NUM_PHASES + 1];
+    long long calls[HEARTYFS_NUM_PHASES + 1];
+} phases;
+
+/**
+ * @brief Get the wall clock time in microseconds
+ *
+ * @return long long - The time in microseconds since the epoch
+ */
+static long long wall_clock_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief Append the trace line of this run, called by exit
+ *
+ * @param status - The exit status of the tool
+ * @param arg - Unused
+ */
+static void trace_finish(int status, void *arg) {
+    (void)arg;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long duration_us = (long long)(now.tv_sec - trace.started.tv_sec) * 1000000
+                          + (now.tv_nsec - trace.started.tv_nsec) / 1000;
+
+    char line[TRACE_LINE_MAX + 128];
+    int length = snprintf(line, sizeof(line), "%lld\t%lld\t%d\t%lld\t%s\n",
+                          trace.start_us, duration_us, status, trace.bytes, trace.command);
+    if (length >= (int)sizeof(line)) {
+        length = sizeof(line) - 1;
+        line[length - 1] = '\n';
+    }
+
+    int fd = open(getenv("HEARTYFS_TRACE"), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1) {
+        perror("Error: Failed to open the trace log");
+        return;
+    }
+    if (write(fd, line, length) != length) {
+        perror("Error: Failed to write the trace log");
+    }
+    close(fd);
+}
+
+/**
+ * @brief Charge the time since the last switch to the running phase
+ */
+static void phase_switch(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    phases.ns[phases.current] += (long long)(now.tv_sec - phases.mark.tv_sec) * 1000000000
+                               + (now.tv_nsec - phases.mark.tv_nsec);
+    phases.mark = now;
+}
+
+/**
+ * @brief Report the phase times of this run, called by exit
+ *
+ * @param status - Unused
+ * @param arg - Unused
+ */
+static void phases_finish(int status, void *arg) {
+    (void)status;
+    (void)arg;
+    phase_switch();
+
+    if (phases.log == NULL) {
+        fprintf(stderr, "%s phases:", phases.tool);
+        for (int i = 0; i <= HEARTYFS_NUM_PHASES; i++) {
+            fprintf(stderr, " %s %.1f us", phase_names[i], phases.ns[i] / 1000.0);
+            if (i != PHASE_OTHER && phases.calls[i] > 1) {
+                fprintf(stderr, " (%lld calls)", phases.calls[i]);
+            }
+            fprintf(stderr, (i < HEARTYFS_NUM_PHASES) ? "," : "\n");
+        }
+        return;
+    }
+
+    char line[TRACE_LINE_MAX];
+    int length = snprintf(line, sizeof(line), "%lld\t%s", phases.start_us, phases.tool);
+    for (int i = 0; i <= HEARTYFS_NUM_PHASES; i++) {
+        length += snprintf(line + length, sizeof(line) - length, "\t%lld", phases.ns[i] / 1000);
+    }
+    length += snprintf(line + length, sizeof(line) - length, "\n");
+
+    int fd = open(phases.log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1) {
+        perror("Error: Failed to open the phase log");
+        return;
+    }
+    if (write(fd, line, length) != length) {
+        perror("Error: Failed to write the phase log");
+    }
+    close(fd);
+}
+
+/**
+ * @brief Start timing the phases of this run if HEARTYFS_PHASES is set
+ *
+ * @param argv0 - The name the tool was run as
+ */
+static void phases_start(const char *argv0) {
+    const char *value = getenv("HEARTYFS_PHASES");
+    if (value == NULL || *value == '\0' || strcmp(value, "0") == 0) {
+        return;
+    }
+    phases.log = (strcmp(value, "1") == 0) ? NULL : value;
+    phases.start_us = wall_clock_us();
+    char tool[FILENAME_MAX];
+    snprintf(tool, sizeof(tool), "%s", argv0);
+    snprintf(phases.tool, sizeof(phases.tool), "%s", basename(tool));
+    phases.current = PHASE_OTHER;
+    clock_gettime(CLOCK_MONOTONIC, &phases.mark);
+    phases.enabled = 1;
+    on_exit(phases_finish, NULL);
+}
+
+/**
+ * @brief Enter a phase, pausing the one running. Every call is paired with
+ * heartyfs_phase_end.
+ *
+ * @param phase - One of HEARTYFS_PHASE_*
+ */
+void heartyfs_phase_begin(int phase) {
+    if (!phases.enabled) {
+        return;
+    }
+    phase_switch();
+    if (phases.depth < PHASE_DEPTH) {
+        phases.stack[phases.depth] = phases.current;
+        phases.current = phase;
+    }
+    phases.depth++;
+    phases.calls[phase]++;
+}
+
+/**
+ * @brief Leave the phase entered last and resume the one it paused
+ */
+void heartyfs_phase_end(void) {
+    if (!phases.enabled) {
+        return;
+    }
+    phase_switch();
+    phases.depth--;
+    if (phases.depth < PHASE_DEPTH) {
+        phases.current = phases.stack[phases.depth];
+    }
+}
+
+/**
+ * @brief Start tracing this run if HEARTYFS_TRACE is set, and timing its phases if
+ * HEARTYFS_PHASES is. Called first thing in main.
+ *
+ * @param argc - The argument count of main
+ * @param argv - The arguments of main
+ */
+void heartyfs_trace_start(int argc, char *argv[]) {
+    phases_start(argv[0]);
+    const char *path = getenv("HEARTYFS_TRACE");
+    if (path == NULL || *path == '\0') {
+        return;
+    }
+
+    trace.enabled = 1;
+    trace.start_us = wall_clock_us();
+    clock_gettime(CLOCK_MONOTONIC, &trace.started);
+
+    // The tool is recorded by name so a replay can run it from any bin directory
+    char tool[TRACE_LINE_MAX];
+    snprintf(tool, sizeof(tool), "%s", argv[0]);
+    size_t used = snprintf(trace.command, sizeof(trace.command), "%s", basename(tool));
+    for (int i = 1; i < argc && used < sizeof(trace.command); i++) {
+        char *arg = trace.command + used + 1;
+        used += snprintf(trace.command + used, sizeof(trace.command) - used, "\t%s", argv[i]);
+        // Tabs and newlines separate fields and lines, so they cannot appear inside one
+        for (char *c = arg; *c != '\0'; c++) {
+            if (*c == '\t' || *c == '\n') {
+                *c = ' ';
+            }
+        }
+    }
+    on_exit(trace_finish, NULL);
+}
+
+/**
+ * @brief Add to the number of file bytes this run read or wrote
+ *
+ * @param bytes - The number of bytes
+ */
+void heartyfs_trace_bytes(long long bytes) {
+    if (trace.enabled) {
+        trace.bytes += bytes;
+    }
+}
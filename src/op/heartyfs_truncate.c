@@ -0,0 +1,82 @@
+/**
+ * @file heartyfs_truncate.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file sets the size of a file in the heartyfs file system, freeing the
+ * blocks past a new smaller end or adding holes up to a larger one. With -p it also
+ * reserves blocks for every hole up to the size, as one contiguous run when possible,
+ * so a file filled in later by partial writes keeps a contiguous layout.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
+    printf("heartyfs_truncate\n");
+    int preallocate = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "p")) != -1) {
+        if (opt == 'p') {
+            preallocate = 1;
+        } else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - 2) {
+        fprintf(stderr, "Usage: %s [-p] <file_path> <size>\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[optind];
+    char *end;
+    long size = strtol(argv[optind + 1], &end, 10);
+    if (*end != '\0' || size < 0 || size > INODE_BLOCKS * DATA_BLOCK_NAME_SIZE) {
+        fprintf(stderr, "Error: Size must be between 0 and %d bytes\n", INODE_BLOCKS * DATA_BLOCK_NAME_SIZE);
+        return 1;
+    }
+
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
+        return 1;
+    }
+
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
+
+    int result;
+    if (preallocate) {
+        // Shrink first if asked to, preallocation itself only ever grows the file
+        struct heartyfs_inode *inode;
+        result = 0;
+        if (find_inode_by_path(buffer, path, &inode) != -1 && inode->type == 0 && inode->size > size) {
+            result = truncate_file(buffer, bitmap, path, size);
+        }
+        if (result != -1) {
+            result = preallocate_file(buffer, bitmap, path, size);
+        }
+        if (result != -1) {
+            printf("Success: %s is %ld bytes, %d blocks reserved\n", path, size, result);
+        }
+    } else {
+        result = truncate_file(buffer, bitmap, path, size);
+        if (result != -1) {
+            printf("Success: %s is %ld bytes\n", path, size);
+        }
+    }
+    if (result == -1) {
+        fprintf(stderr, "Error: Failed to truncate %s\n", path);
+    }
+
+    heartyfs_sync(buffer);
+
+    heartyfs_unmount(buffer);
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+/**
+ * @file heartyfs_view.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file gives read views of files in the heartyfs file system: the content
+ * as a list of spans pointing straight into the mapped image, one per data block, so
+ * a file can be parsed or written out in place without being copied. Holes and the
+ * unwritten tail of short blocks are spans over one shared buffer of zeros.
+ *
+ * A view stays valid until the file is changed or the image is unmounted. Only the
+ * mmap engine maps the image flat, with the pread and window engines block pointers
+ * move, so there the content is copied out once and the view is a single span over
+ * the copy.
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char view_zeros[INODE_BLOCKS * DATA_BLOCK_NAME_SIZE];
+
+/**
+ * @brief Append a span to a view, runs of zeros are joined into one span
+ *
+ * @param view - The view
+ * @param data - The start of the span
+ * @param length - The length of the span
+ */
+static void add_span(struct heartyfs_view *view, const char *data, int length) {
+    if (length == 0) {
+        return;
+    }
+    struct heartyfs_span *last = (view->count > 0) ? &view->spans[view->count - 1] : NULL;
+    if (data == view_zeros && last != NULL && last->data == view_zeros) {
+        last->length += length;
+        return;
+    }
+    view->spans[view->count].data = data;
+    view->spans[view->count].length = length;
+    view->count++;
+}
+
+/**
+ * @brief Open a read view of a file. Its data blocks are checked first, so a view is
+ * never handed out over a corrupted block.
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param path - The path of the file
+ * @param view - Filled with the spans, close it with heartyfs_view_close
+ * @return int - 0 if successful, -1 if failed
+ */
+int heartyfs_view_open(void *buffer, const char *path, struct heartyfs_view *view) {
+    memset(view, 0, sizeof(*view));
+    struct heartyfs_inode *inode;
+    int inode_block_id = find_inode_by_path(buffer, path, &inode);
+    if (inode_block_id == -1) {
+        fprintf(stderr, "Error: File %s does not exist\n", path);
+        return -1;
+    }
+    if (inode->type != 0) {
+        fprintf(stderr, "Error: %s is not a regular file\n", path);
+        return -1;
+    }
+
+    // Start reading ahead every block of the file before the first one is touched
+    heartyfs_prefetch_file(buffer, inode);
+
+    int blocks[INODE_BLOCKS];
+    int num_blocks = 0;
+    for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
+        if (inode->data_blocks[i] != HOLE_BLOCK) {
+            blocks[num_blocks++] = data_block_of(inode->data_blocks[i]);
+        }
+    }
+    int bad_block;
+    if (verify_data_blocks(buffer, blocks, num_blocks, &bad_block) > 0) {
+        fprintf(stderr, "Error: Block %d of %s is corrupted (checksum mismatch)\n", bad_block, path);
+        return -1;
+    }
+
+    // Block i holds bytes [i * 508, i * 508 + size), holes and short blocks read as zeros.
+    // A file has fewer blocks than the block cache and the window engine keep, so every
+    // pointer taken here is still valid at the end of the loop.
+    inode = (struct heartyfs_inode *)heartyfs_block(buffer, inode_block_id);
+    view->size = inode->size;
+    view->spans = malloc((2 * INODE_BLOCKS + 1) * sizeof(struct heartyfs_span));
+    int remaining = inode->size;
+    for (int i = 0; i < INODE_BLOCKS && remaining > 0; i++) {
+        int chunk = (remaining > DATA_BLOCK_NAME_SIZE) ? DATA_BLOCK_NAME_SIZE : remaining;
+        int length = 0;
+        int block_id = inode->data_blocks[i];
+        if (block_id == -1) {
+            break;
+        }
+        if (block_id != HOLE_BLOCK) {
+            const char *data = data_entry_bytes(buffer, block_id, &length);
+            length = (chunk > length) ? length : chunk;
+            add_span(view, data, length);
+        }
+        add_span(view, view_zeros, chunk - length);
+        remaining -= chunk;
+    }
+    add_span(view, view_zeros, remaining);
+
+    if (!heartyfs_flat_mapping() && view->size > 0) {
+        view->copy = malloc(view->size);
+        int offset = 0;
+        for (int i = 0; i < view->count; i++) {
+            memcpy(view->copy + offset, view->spans[i].data, view->spans[i].length);
+            offset += view->spans[i].length;
+        }
+        view->spans[0].data = view->copy;
+        view->spans[0].length = view->size;
+        view->count = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Close a read view
+ *
+ * @param view - The view
+ */
+void heartyfs_view_close(struct heartyfs_view *view) {
+    free(view->spans);
+    free(view->copy);
+    memset(view, 0, sizeof(*view));
+}
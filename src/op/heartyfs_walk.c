@@ -0,0 +1,213 @@
+/**
+ * @file heartyfs_walk.c
+ * @author Panupong Dangkajitpetch (King)
+ * @brief This file is the parallel tree walker shared by heartyfs_find and heartyfs_du.
+ * Every worker thread owns a deque of directories still to read: it pushes and pops
+ * its own work at the tail (depth first, warm blocks) and, when it runs dry, steals
+ * from the head of another worker's deque (the oldest, usually largest, subtrees).
+ * @version 0.1
+ * @date 2024-10-03
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include "../heartyfs.h"
+#include "heartyfs_functions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+// The work of one thread, the owner uses the tail and thieves the head
+struct walk_deque {
+    pthread_mutex_t lock;
+    struct heartyfs_walk_entry **items;   // Directories waiting to be read
+    int head;
+    int tail;
+    int capacity;
+};
+
+struct walk_worker {
+    pthread_t thread;
+    int index;
+    struct walk_shared *shared;
+};
+
+struct walk_shared {
+    void *buffer;
+    int num_threads;
+    int entry_info;     // Directories carry entry_info, children need not be read to know their type
+    heartyfs_walk_visit visit;
+    void **states;
+    struct walk_deque *deques;
+    int pending;        // Items pushed and not finished yet, the walk ends at 0
+};
+
+static void deque_push(struct walk_deque *deque, struct heartyfs_walk_entry *item) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head > 0 && deque->tail == deque->capacity) {
+        // Reuse the space thieves left at the head
+        memmove(deque->items, deque->items + deque->head, (deque->tail - deque->head) * sizeof(struct heartyfs_walk_entry *));
+        deque->tail -= deque->head;
+        deque->head = 0;
+    }
+    if (deque->tail == deque->capacity) {
+        deque->capacity = (deque->capacity == 0) ? 64 : deque->capacity * 2;
+        deque->items = realloc(deque->items, deque->capacity * sizeof(struct heartyfs_walk_entry *));
+    }
+    deque->items[deque->tail++] = item;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static struct heartyfs_walk_entry *deque_pop(struct walk_deque *deque, int steal) {
+    struct heartyfs_walk_entry *item = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) {
+        item = steal ? deque->items[deque->head++] : deque->items[--deque->tail];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return item;
+}
+
+/**
+ * @brief Queue an entry on a worker's deque
+ *
+ * @param shared - The walk
+ * @param index - The worker receiving the entry
+ * @param entry - The entry, copied
+ */
+static void walk_push(struct walk_shared *shared, int index, const struct heartyfs_walk_entry *entry) {
+    struct heartyfs_walk_entry *item = malloc(sizeof(struct heartyfs_walk_entry));
+    *item = *entry;
+    __atomic_add_fetch(&shared->pending, 1, __ATOMIC_RELAXED);
+    deque_push(&shared->deques[index], item);
+}
+
+/**
+ * @brief Visit one entry and queue the entries of a directory
+ *
+ * @param shared - The walk
+ * @param index - The worker doing the visit
+ * @param entry - The entry to visit
+ */
+static void walk_visit(struct walk_shared *shared, int index, const struct heartyfs_walk_entry *entry) {
+    shared->visit(shared->buffer, entry, shared->states ? shared->states[index] : NULL);
+    if (entry->info != ENTRY_INFO_DIRECTORY) {
+        return;
+    }
+
+    struct heartyfs_directory *dir = (struct heartyfs_directory *)heartyfs_block(shared->buffer, entry->block_id);
+    int size = dir->size;
+    for (int i = 2; i < size; i++) {
+        struct heartyfs_walk_entry child;
+        child.block_id = dir->entries[i].block_id;
+        child.parent_block_id = entry->block_id;
+        child.depth = entry->depth + 1;
+        child.info = shared->entry_info ? dir->entry_info[i] : entry_info_of(heartyfs_block(shared->buffer, child.block_id));
+        if (snprintf(child.path, sizeof(child.path), "%s/%s", strcmp(entry->path, "/") == 0 ? "" : entry->path,
+                     dir->entries[i].file_name) >= (int)sizeof(child.path)) {
+            fprintf(stderr, "Error: Path too long below %s, skipped\n", entry->path);
+            continue;
+        }
+
+        // Files are visited right away, only directories are worth handing to other threads
+        if (child.info == ENTRY_INFO_DIRECTORY) {
+            walk_push(shared, index, &child);
+        } else {
+            shared->visit(shared->buffer, &child, shared->states ? shared->states[index] : NULL);
+        }
+        dir = (struct heartyfs_directory *)heartyfs_block(shared->buffer, entry->block_id);
+    }
+}
+
+static void *walk_worker_main(void *arg) {
+    struct walk_worker *worker = arg;
+    struct walk_shared *shared = worker->shared;
+    for (;;) {
+        struct heartyfs_walk_entry *item = deque_pop(&shared->deques[worker->index], 0);
+        for (int i = 1; item == NULL && i < shared->num_threads; i++) {
+            item = deque_pop(&shared->deques[(worker->index + i) % shared->num_threads], 1);
+        }
+        if (item == NULL) {
+            if (__atomic_load_n(&shared->pending, __ATOMIC_ACQUIRE) == 0) {
+                return NULL;
+            }
+            sched_yield();
+            continue;
+        }
+        walk_visit(shared, worker->index, item);
+        free(item);
+        __atomic_sub_fetch(&shared->pending, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Walk a subtree with work-stealing threads, calling visit once for every
+ * directory and file in it (the subtree root included). Visits run concurrently and in
+ * no particular order; each thread passes its own state so visit needs no locking.
+ * Only the flat mapping can be shared between threads, the buffer cache walks on one.
+ *
+ * @param buffer - The buffer containing the disk image
+ * @param path - The directory to walk
+ * @param num_threads - The number of walker threads
+ * @param visit - Called for every entry
+ * @param states - One state per thread handed to visit (states[thread]), may be NULL
+ * @return int - The number of threads used, -1 if path is not a directory
+ */
+int heartyfs_walk(void *buffer, const char *path, int num_threads, heartyfs_walk_visit visit, void **states) {
+    struct heartyfs_directory *dir;
+    int block_id = find_directory_by_path(buffer, path, &dir);
+    if (block_id == -1 || dir->type != 1) {
+        fprintf(stderr, "Error: Directory %s not found\n", path);
+        return -1;
+    }
+    if (num_threads < 1 || !heartyfs_flat_mapping()) {
+        num_threads = 1;
+    }
+
+    struct heartyfs_info *info = get_info((unsigned char *)heartyfs_block(buffer, 1));
+    struct walk_shared shared = {0};
+    shared.buffer = buffer;
+    shared.num_threads = num_threads;
+    shared.entry_info = (info != NULL && (info->features & HEARTYFS_FEATURE_ENTRY_INFO));
+    shared.visit = visit;
+    shared.states = states;
+    shared.deques = calloc(num_threads, sizeof(struct walk_deque));
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&shared.deques[i].lock, NULL);
+    }
+
+    struct heartyfs_walk_entry root;
+    root.block_id = block_id;
+    root.parent_block_id = dir->entries[1].block_id;
+    root.depth = 0;
+    root.info = ENTRY_INFO_DIRECTORY;
+    snprintf(root.path, sizeof(root.path), "%s", path);
+    size_t length = strlen(root.path);
+    while (length > 1 && root.path[length - 1] == '/') {
+        root.path[--length] = '\0';
+    }
+    walk_push(&shared, 0, &root);
+
+    struct walk_worker *workers = calloc(num_threads, sizeof(struct walk_worker));
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].index = t;
+        workers[t].shared = &shared;
+        if (t > 0) {
+            pthread_create(&workers[t].thread, NULL, walk_worker_main, &workers[t]);
+        }
+    }
+    walk_worker_main(&workers[0]);
+    for (int t = 1; t < num_threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_destroy(&shared.deques[i].lock);
+        free(shared.deques[i].items);
+    }
+    free(shared.deques);
+    free(workers);
+    return num_threads;
+}
@@ -18,30 +18,17 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <libgen.h>
+#include <limits.h>
 
 /**
- * @brief Write a file to the heartyfs file system
+ * @brief Copy an external file into a write-back file at a byte offset
  * 
- * @param buffer - The buffer containing the disk image
- * @param bitmap - The bitmap containing the block allocation information
- * @param heartyfs_path - The path of the file in the heartyfs
+ * @param file - The write-back file
  * @param external_path - The path of the external file
+ * @param offset - The byte offset to write at
  * @return int - 0 if successful, -1 if failed
  */
-int write_file(void *buffer, unsigned char *bitmap, const char *heartyfs_path, const char *external_path) {
-    struct heartyfs_inode *inode;
-    int inode_block_id = find_inode_by_path(buffer, heartyfs_path, &inode);
-
-    if (inode_block_id == -1) {
-        fprintf(stderr, "Error: File %s does not exist in heartyfs\n", heartyfs_path);
-        return -1;
-    }
-
-    if (inode->type != 0) {
-        fprintf(stderr, "Error: %s is not a regular file\n", heartyfs_path);
-        return -1;
-    }
-
+int read_external_file(struct heartyfs_wb_file *file, const char *external_path, int offset) {
     // Open the external file
     int ext_fd = open(external_path, O_RDONLY);
     if (ext_fd < 0) {
@@ -58,88 +45,111 @@ int write_file(void *buffer, unsigned char *bitmap, const char *heartyfs_path, c
     }
 
     // Check if the file size exceeds the heartyfs limit
-    if (st.st_size > INODE_BLOCKS * DATA_BLOCK_NAME_SIZE) {
+    if (offset + st.st_size > INODE_BLOCKS * DATA_BLOCK_NAME_SIZE) {
         fprintf(stderr, "Error: File size exceeds heartyfs limit\n");
         close(ext_fd);
         return -1;
     }
 
-    // Clear existing data blocks
-    for (int i = 0; i < INODE_BLOCKS && inode->data_blocks[i] != -1; i++) {
-        set_block_used(bitmap, inode->data_blocks[i]);
-        memset((char *)buffer + inode->data_blocks[i] * BLOCK_SIZE, 0, BLOCK_SIZE);
-        inode->data_blocks[i] = -1;
-    }
-
-    // Write the file content
+    char chunk[DATA_BLOCK_NAME_SIZE];
     int remaining = st.st_size;
-    int block_index = 0;
+    int position = offset;
+    if (remaining == 0) {
+        wb_write(file, position, chunk, 0);
+    }
     while (remaining > 0) {
-        int block_id = find_free_block(bitmap);
-        if (block_id == -1) {
-            fprintf(stderr, "Error: No free blocks available\n");
-            close(ext_fd);
-            return -1;
-        }
-
-        set_block_used(bitmap, block_id);
-        inode->data_blocks[block_index] = block_id;
-
-        struct heartyfs_data_block *data_block = (struct heartyfs_data_block *)((char *)buffer + block_id * BLOCK_SIZE);
         int to_read = (remaining > DATA_BLOCK_NAME_SIZE) ? DATA_BLOCK_NAME_SIZE : remaining;
-        data_block->size = read(ext_fd, data_block->name, to_read);
-
-        if (data_block->size < 0) {
+        int bytes_read = read(ext_fd, chunk, to_read);
+        if (bytes_read <= 0) {
             perror("Error: Failed to read from external file");
             close(ext_fd);
             return -1;
         }
-
-        remaining -= data_block->size;
-        block_index++;
+        wb_write(file, position, chunk, bytes_read);
+        heartyfs_trace_bytes(bytes_read);
+        position += bytes_read;
+        remaining -= bytes_read;
     }
 
-    inode->size = st.st_size;
     close(ext_fd);
     return 0;
 }
 
+/**
+ * @brief Write a file to the heartyfs file system. The data is buffered and the
+ * blocks for the whole file are chosen at once when it is closed.
+ * 
+ * @param buffer - The buffer containing the disk image
+ * @param bitmap - The bitmap containing the block allocation information
+ * @param heartyfs_path - The path of the file in the heartyfs
+ * @param external_path - The path of the external file
+ * @param offset - The byte offset to write at keeping the rest of the file, -1 to replace the file.
+ * Ranges past the old end of file that are not written stay unallocated holes.
+ * @return int - 0 if successful, -1 if failed
+ */
+int write_file(void *buffer, unsigned char *bitmap, const char *heartyfs_path, const char *external_path, int offset) {
+    struct heartyfs_wb_file *file = wb_open(buffer, heartyfs_path, offset == -1);
+    if (file == NULL) {
+        return -1;
+    }
+
+    // The copy is the read of the external file and the flush into data blocks
+    heartyfs_phase_begin(HEARTYFS_PHASE_COPY);
+    int result = read_external_file(file, external_path, (offset == -1) ? 0 : offset);
+    if (result != 0) {
+        wb_discard(file);
+    } else {
+        result = wb_close(buffer, bitmap, file);
+    }
+    heartyfs_phase_end();
+    return result;
+}
+
+/**
+ * @brief Parse the byte offset given with -o
+ * 
+ * @param arg - The argument, a decimal number of bytes
+ * @return int - The offset, -2 if the argument is not a valid offset
+ */
+int parse_offset(const char *arg) {
+    char *end;
+    long offset = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || offset < 0 || offset > INT_MAX) {
+        return -2;
+    }
+    return (int)offset;
+}
+
 int main(int argc, char *argv[]) {
+    heartyfs_trace_start(argc, argv);
     printf("heartyfs_write\n");
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <heartyfs_file_path> <external_file_path>\n", argv[0]);
-        return 1;
+    int offset = -1;
+    if (argc == 5 && strcmp(argv[1], "-o") == 0) {
+        offset = parse_offset(argv[2]);
+        argv += 2;
+        argc -= 2;
     }
-
-    int fd = open(DISK_FILE_PATH, O_RDWR);
-    if (fd < 0) {
-        perror("Error: Cannot open the disk file");
+    if (argc != 3 || offset < -1) {
+        fprintf(stderr, "Usage: %s [-o offset] <heartyfs_file_path> <external_file_path>\n", argv[0]);
         return 1;
     }
 
-    void *buffer = mmap(NULL, DISK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("Error: Cannot map the disk file onto memory");
-        close(fd);
+    void *buffer = heartyfs_mount(HEARTYFS_RDWR);
+    if (buffer == NULL) {
         return 1;
     }
 
-    unsigned char *bitmap = (unsigned char *)buffer + BLOCK_SIZE;
+    unsigned char *bitmap = (unsigned char *)heartyfs_block(buffer, 1);
 
-    if (write_file(buffer, bitmap, argv[1], argv[2]) == 0) {
+    if (write_file(buffer, bitmap, argv[1], argv[2], offset) == 0) {
         printf("Success: File %s written to %s successfully\n", argv[2], argv[1]);
     } else {
         fprintf(stderr, "Error: Failed to write file %s to %s\n", argv[2], argv[1]);
     }
 
-    if (msync(buffer, DISK_SIZE, MS_SYNC) == -1) {
-        perror("Error: Failed to sync changes to disk");
-    }
+    heartyfs_sync(buffer);
 
-    if (munmap(buffer, DISK_SIZE) == -1) {
-        perror("Error: Failed to unmap file");
-    }
-    close(fd);
+    heartyfs_unmount(buffer);
 
     return 0;
 }
\ No newline at end of file
@@ -1,2 +1,2 @@
-gcc -o bin/heartyfs_ls heartyfs_ls.c 
+gcc -pthread -o bin/heartyfs_ls heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_ls.c 
 bin/heartyfs_ls /dir1/dir2/dir3/
\ No newline at end of file
@@ -1,2 +1,2 @@
-gcc -o bin/heartyfs_mkdir heartyfs_functions.c heartyfs_mkdir.c
+gcc -pthread -o bin/heartyfs_mkdir heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_mkdir.c
 bin/heartyfs_mkdir /dir1/dir2/dir3/
\ No newline at end of file
@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_mv heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_mv.c 
+bin/heartyfs_mv /dir1/file /dir2/
\ No newline at end of file
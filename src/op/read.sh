@@ -1,2 +1,2 @@
-gcc -o bin/heartyfs_read heartyfs_functions.c heartyfs_read.c 
+gcc -pthread -o bin/heartyfs_read heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_view.c heartyfs_read.c 
 bin/heartyfs_read /dir1/dir2/dir3/abc.xyz
\ No newline at end of file
@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_readmany heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_batch.c heartyfs_output.c heartyfs_readmany.c 
+bin/heartyfs_readmany /dir1/a /dir1/b /dir2/c > files.stream
\ No newline at end of file
@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_replay heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_walk.c heartyfs_replay.c 
+bin/heartyfs_replay -i /tmp/heartyfs.base /tmp/heartyfs.trace
\ No newline at end of file
@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_resize heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_resize.c 
+bin/heartyfs_resize 2048
@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_restore heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_walk.c heartyfs_restore.c 
+bin/heartyfs_restore /restored/ < /tmp/heartyfs.tar
\ No newline at end of file
@@ -1,2 +1,2 @@
-gcc -o bin/heartyfs_rm heartyfs_functions.c heartyfs_rm.c 
+gcc -pthread -o bin/heartyfs_rm heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_rm.c 
 bin/heartyfs_rm /dir1/dir2/dir3/abc.xyz
\ No newline at end of file
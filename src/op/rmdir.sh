@@ -1,2 +1,2 @@
-gcc -o bin/heartyfs_rmdir heartyfs_functions.c heartyfs_rmdir.c 
+gcc -pthread -o bin/heartyfs_rmdir heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_rmdir.c 
 bin/heartyfs_rmdir /dir1/dir2/dir3/
\ No newline at end of file
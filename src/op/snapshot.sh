@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_snapshot heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_snapshot.c 
+bin/heartyfs_snapshot /dir1/dir2/ /dir1/dir2.snap/
\ No newline at end of file
@@ -0,0 +1,2 @@
+gcc -pthread -o bin/heartyfs_truncate heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_truncate.c 
+bin/heartyfs_truncate -p /dir1/file 20000
\ No newline at end of file
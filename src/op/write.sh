@@ -1,2 +1,2 @@
-gcc -o bin/heartyfs_write heartyfs_functions.c heartyfs_write.c 
+gcc -pthread -o bin/heartyfs_write heartyfs_functions.c heartyfs_disk.c heartyfs_checksum.c heartyfs_trace.c heartyfs_write.c 
 bin/heartyfs_write /dir1/dir2/dir3/abc.xyz /home/pnx/random.txt
\ No newline at end of file